@@ -3,102 +3,543 @@
  * Wasim
  * Shifaa
 */
+#define _GNU_SOURCE     // For pthread_setaffinity_np and CPU_SET
 #include "RUDP_API.h"
 #include <arpa/inet.h>  // For functions like inet_pton
 #include <errno.h>      // For error handling
+#include <linux/filter.h> // For the reuseport steering BPF program
+#include <pthread.h>    // For the sharded receiver worker threads
+#include <sched.h>      // For pinning workers to cores
 #include <stdio.h>      // For standard I/O operations
 #include <stdlib.h>     // For dynamic memory allocation and other standard functions
 #include <string.h>     // For string manipulation functions
 #include <sys/socket.h> // For socket related functions
 #include <sys/time.h>   // For time related functions
 #include <sys/types.h>  // For data types
+#include <sys/uio.h>    // For struct iovec
 #include <time.h>       // For time related functions
 #include <unistd.h>     // For POSIX operating system API
 
+// Default transport: kernel UDP sockets and the monotonic clock
+static int socket_open(void *ctx) {
+    (void)ctx;
+    return socket(AF_INET, SOCK_DGRAM, 0);
+}
+
+static int socket_bind(void *ctx, int socket, const struct sockaddr *addr, socklen_t len) {
+    (void)ctx;
+    return bind(socket, addr, len);
+}
+
+static int socket_connect(void *ctx, int socket, const struct sockaddr *addr, socklen_t len) {
+    (void)ctx;
+    return connect(socket, addr, len);
+}
+
+static ssize_t socket_send(void *ctx, int socket, const void *buf, size_t len) {
+    (void)ctx;
+    return sendto(socket, buf, len, 0, NULL, 0);
+}
+
+static ssize_t socket_recv(void *ctx, int socket, void *buf, size_t len,
+                           struct sockaddr *from, socklen_t *fromlen) {
+    (void)ctx;
+    return recvfrom(socket, buf, len, 0, from, fromlen);
+}
+
+static int socket_set_timeout(void *ctx, int socket, const struct timeval *tv) {
+    (void)ctx;
+    return setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, tv, sizeof(*tv));
+}
+
+static int socket_close(void *ctx, int socket) {
+    (void)ctx;
+    return close(socket);
+}
+
+static int socket_local_address(void *ctx, int socket, struct sockaddr *addr, socklen_t *len) {
+    (void)ctx;
+    return getsockname(socket, addr, len);
+}
+
+static uint64_t monotonic_now_ms(void *ctx) {
+    (void)ctx;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static const RUDP_Transport socket_transport = {
+    socket_open, socket_bind, socket_connect, socket_send, socket_recv,
+    socket_set_timeout, socket_close, socket_local_address, monotonic_now_ms, NULL
+};
+
+// Transport shared by all threads, replaced by rudp_set_transport
+static const RUDP_Transport *transport = &socket_transport;
+
+#define net_open() transport->open(transport->ctx)
+#define net_bind(s, a, l) transport->bind(transport->ctx, (s), (a), (l))
+#define net_connect(s, a, l) transport->connect(transport->ctx, (s), (a), (l))
+#define net_send(s, b, l) transport->send(transport->ctx, (s), (b), (l))
+#define net_recv(s, b, l, f, fl) transport->recv(transport->ctx, (s), (b), (l), (f), (fl))
+#define net_set_timeout(s, tv) transport->set_timeout(transport->ctx, (s), (tv))
+#define net_close(s) transport->close(transport->ctx, (s))
+#define net_local_address(s, a, l) transport->local_address(transport->ctx, (s), (a), (l))
+
+void rudp_set_transport(const RUDP_Transport *t) {
+    transport = (t != NULL) ? t : &socket_transport;
+}
+
+uint64_t rudp_now_ms() {
+    return transport->now_ms(transport->ctx);
+}
+
+// Protocol state of a connection. It is kept per socket, so one thread can drive
+// several connections and a connection can move between threads.
+typedef struct Connection {
+    int seq_number;             // Next sequence number the receiver expects
+    // Number of the next message sent and of the message being received. Sequence
+    // numbers restart with every message, so packets delayed or retransmitted from
+    // the previous message are told apart by their message number.
+    uint16_t send_message_num;
+    uint16_t message_number;
+    int compress;               // Payload compression negotiated in the handshake
+    RUDP_CompStats stats;       // Compression counters
+} Connection;
+
+// Indexed by socket descriptor. A slot is only written by the thread driving its
+// socket, so the packet path takes no lock. The fields rudp_compression_negotiated and
+// rudp_compression_stats may read from other threads are written with atomic stores.
+static Connection connections[RUDP_MAX_SOCKETS];
+
+// Gets the state of a socket, or NULL (setting errno) if the descriptor is out of range
+static Connection *connection_of(int socket) {
+    if (socket < 0 || socket >= RUDP_MAX_SOCKETS) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &connections[socket];
+}
+
+// Starts a new connection on a socket, at message 0 and packet 0
+static void connection_reset(Connection *conn, int compress) {
+    conn->seq_number = 0;
+    conn->send_message_num = 0;
+    conn->message_number = 0;
+    __atomic_store_n(&conn->compress, compress, __ATOMIC_RELAXED);
+    __atomic_store_n(&conn->stats.raw_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&conn->stats.wire_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&conn->stats.packets_compressed, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&conn->stats.packets_raw, 0, __ATOMIC_RELAXED);
+}
+
+// Adds to a counter of a connection. Only the connection's thread writes it, so a
+// relaxed load and store suffice, and readers on other threads never see a torn value.
+static void count(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+// Scratch addresses and timeouts are thread local so sharded workers share nothing
+
 // Struct to hold server address information
-struct sockaddr_in server_address;
+__thread struct sockaddr_in server_address;
 
 // Struct to hold client address information
-struct sockaddr_in client_address;
+__thread struct sockaddr_in client_address;
 
 //struct Timeout value for socket operations.
- struct timeval timeout;
+__thread struct timeval timeout;
 
 int rudp_socket() {
     // Create a new UDP socket
-    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    int sockfd = net_open();
     // Check if socket creation failed
     if (sockfd == -1) {
         perror("Socket creation failed");
         return -1;
     }
+    Connection *conn = connection_of(sockfd);
+    if (conn == NULL) {
+        fprintf(stderr, "Socket descriptor %d is beyond RUDP_MAX_SOCKETS\n", sockfd);
+        net_close(sockfd);
+        errno = EMFILE;
+        return -1;
+    }
+    connection_reset(conn, 0);
     return sockfd;
 }
 
-int rudp_send(int socket, const char *data, int size) {
-    // Calculate the number of packets and size of the last packet
-    int packets = size / MAX_PACK_SIZE;
-    int last_pack_size = size % MAX_PACK_SIZE;
+static int waiting_ack_for(int socket, int sequal_num, int fwd, int message, uint64_t s, uint64_t t);
+
+// Retransmission timeout, also the receive timeout rudp_connect gives the socket
+#define RETRANSMIT_MS 1000
+
+// Sends one segment until it is acknowledged or its policy gives up on it.
+// Returns 1 when acknowledged, 0 when abandoned, or -1 on error.
+static int send_segment(int socket, RUDP_Packet *rudp, const RUDP_Policy *policy, uint64_t deadline) {
+    int attempts = 0;
+    while (1) {
+        uint64_t now = rudp_now_ms();
+        if (now >= deadline) {
+            return 0;
+        }
+        if (policy->mode == RUDP_LIMITED_RETX && attempts > policy->max_retx) {
+            return 0;
+        }
+        if (net_send(socket, rudp, sizeof(RUDP_Packet)) == -1) {
+            perror("can't send the data");
+            return -1;
+        }
+        attempts++;
+        uint64_t wait = deadline - now < RETRANSMIT_MS ? deadline - now : RETRANSMIT_MS;
+        if (waiting_ack_for(socket, rudp->sequalNum, rudp->flags.isFwd, rudp->messageNum, now, wait) > 0) {
+            return 1;
+        }
+    }
+}
+
+// Tells the receiver to skip ahead to seq, or to end the message when fin is set.
+// The marker itself is always sent fully reliably, so it may outlive a time-to-live.
+static int send_forward(int socket, RUDP_Packet *rudp, int message, int seq, int fin) {
+    static const RUDP_Policy reliable = { RUDP_RELIABLE, 0, 0 };
+    memset(rudp, 0, sizeof(RUDP_Packet));
+    rudp->messageNum = (uint16_t)message;
+    rudp->sequalNum = seq;
+    rudp->flags.isFwd = 1;
+    rudp->flags.fin = fin;
+    rudp->checksum = calculate_checksum(rudp);
+    return send_segment(socket, rudp, &reliable, UINT64_MAX);
+}
+
+// Connection preference for payload compression
+static int compression_enabled = 0;
+
+void rudp_set_compression(int enabled) {
+    compression_enabled = enabled != 0;
+}
+
+int rudp_compression_negotiated(int socket) {
+    Connection *conn = connection_of(socket);
+    return conn != NULL && __atomic_load_n(&conn->compress, __ATOMIC_RELAXED);
+}
+
+void rudp_compression_stats(int socket, RUDP_CompStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    Connection *conn = connection_of(socket);
+    if (conn != NULL) {
+        stats->raw_bytes = __atomic_load_n(&conn->stats.raw_bytes, __ATOMIC_RELAXED);
+        stats->wire_bytes = __atomic_load_n(&conn->stats.wire_bytes, __ATOMIC_RELAXED);
+        stats->packets_compressed = __atomic_load_n(&conn->stats.packets_compressed, __ATOMIC_RELAXED);
+        stats->packets_raw = __atomic_load_n(&conn->stats.packets_raw, __ATOMIC_RELAXED);
+    }
+}
+
+// Fills the payload of a data packet from the front of data, compressing it when the
+// connection negotiated it and the sample looks compressible. Returns the number of
+// bytes consumed.
+static int fill_payload(Connection *conn, RUDP_Packet *rudp, const char *data, int remaining) {
+    int length = remaining < MAX_PACK_SIZE ? remaining : MAX_PACK_SIZE;
+    if (conn->compress) {
+        int window = remaining < MAX_RAW_SIZE ? remaining : MAX_RAW_SIZE;
+        int consumed = 0;
+        if (rudp_compressible(data, window)) {
+            int packed = rudp_compress(data, window, rudp->data, MAX_PACK_SIZE, &consumed);
+            if (packed > 0 && packed < consumed) {
+                rudp->flags.isComp = 1;
+                rudp->length = packed;
+                rudp->rawLength = consumed;
+                count(&conn->stats.raw_bytes, consumed);
+                count(&conn->stats.wire_bytes, packed);
+                count(&conn->stats.packets_compressed, 1);
+                return consumed;
+            }
+        }
+    }
+    memcpy(rudp->data, data, length);
+    rudp->length = length;
+    rudp->rawLength = length;
+    if (conn->compress) {
+        count(&conn->stats.raw_bytes, length);
+        count(&conn->stats.wire_bytes, length);
+        count(&conn->stats.packets_raw, 1);
+    }
+    return length;
+}
+
+// Copies the payload of a received data packet into a new buffer, decompressing it if
+// needed. Counts it when the connection negotiated compression.
+static int copy_payload(Connection *conn, RUDP_Packet *rudp, char **buffer, int *size) {
+    int length = rudp->flags.isComp ? rudp->rawLength : rudp->length;
+    *buffer = malloc(length > 0 ? length : 1);
+    if (*buffer == NULL) {
+        perror("Failed to allocate memory for buffer");
+        return -1;
+    }
+    if (rudp->flags.isComp) {
+        if (rudp->length > MAX_PACK_SIZE ||
+            rudp_decompress(rudp->data, rudp->length, *buffer, length) != length) {
+            fprintf(stderr, "Failed to decompress packet %d\n", rudp->sequalNum);
+            free(*buffer);
+            *buffer = NULL;
+            return -1;
+        }
+    } else {
+        memcpy(*buffer, rudp->data, length);
+    }
+    if (conn->compress) {
+        count(rudp->flags.isComp ? &conn->stats.packets_compressed : &conn->stats.packets_raw, 1);
+        count(&conn->stats.raw_bytes, length);
+        count(&conn->stats.wire_bytes, rudp->length);
+    }
+    *size = length;
+    return 0;
+}
+
+// Receive timeouts rudp_receive_stream waits through before giving up on the sender
+#define STREAM_IDLE_LIMIT 30
+
+// Sequence numbers wrap within 0..INT32_MAX so unbounded streams never reach -1 (close)
+static int seq_next(int seq) {
+    return seq == INT32_MAX ? 0 : seq + 1;
+}
+
+// Whether sequence number a is ahead of b, allowing for wrap-around
+static int seq_after(int a, int b) {
+    uint32_t distance = ((uint32_t)a - (uint32_t)b) & INT32_MAX;
+    return distance != 0 && distance < (1u << 30);
+}
+
+// Pulls data from a producer until at least wanted bytes are staged or the stream ends.
+// Returns 0 on success, or -1 if the producer failed or overran the staging buffer.
+static int stage_data(rudp_producer_fn producer, void *arg, char *stage, int *pending, int *eof, int wanted) {
+    while (!*eof && *pending < wanted) {
+        size_t max = MAX_RAW_SIZE - *pending;
+        int64_t got = producer(arg, stage + *pending, max);
+        if (got < 0) {
+            fprintf(stderr, "Stream producer failed\n");
+            return -1;
+        }
+        if ((uint64_t)got > max) {
+            fprintf(stderr, "Stream producer returned more than it was asked for\n");
+            return -1;
+        }
+        *eof = (got == 0);
+        *pending += (int)got;
+    }
+    return 0;
+}
+
+// Sends one message, either from memory (producer is NULL) or pulled from a producer
+// through a bounded staging buffer. Sets *sent to the number of bytes taken from the
+// source. Returns 1 if everything was delivered, 0 if some data was abandoned, or -1.
+static int send_message(int socket, const char *data, int64_t size, rudp_producer_fn producer,
+                        void *arg, const RUDP_Policy *policy, int64_t *sent) {
+    static const RUDP_Policy reliable = { RUDP_RELIABLE, 0, 0 };
+    if (policy == NULL) {
+        policy = &reliable;
+    }
+    // The time-to-live covers the whole message
+    uint64_t deadline = UINT64_MAX;
+    if (policy->mode == RUDP_TIMED) {
+        deadline = rudp_now_ms() + policy->ttl_ms;
+    }
 
     // Allocate memory for the RUDP packet
     RUDP_Packet *rudp = malloc(sizeof(RUDP_Packet));
-    if (rudp == NULL) {
+    char *stage = producer != NULL ? malloc(MAX_RAW_SIZE) : NULL;
+    if (rudp == NULL || (producer != NULL && stage == NULL)) {
         perror("Failed to allocate memory for RUDP packet");
+        free(rudp);
         return -1;
     }
 
+    Connection *conn = connection_of(socket);
+    if (conn == NULL) {
+        perror("Invalid socket");
+        free(stage);
+        free(rudp);
+        return -1;
+    }
+    int delivered = 1;
+    int seq = 0;
+    int eof = (producer == NULL);
+    int64_t offset = 0;   // Bytes taken from the source so far
+    int start = 0;        // Start of pending bytes in the staging buffer
+    int pending = 0;      // Bytes staged but not sent yet
+    *sent = 0;
     // Loop through each packet
-    for (int i = 0; i < packets; i++) {
+    do {
+        const char *window;
+        int64_t available;
+        if (producer == NULL) {
+            window = data + offset;
+            available = size - offset;
+        } else {
+            // Top up the staging buffer so the next packet can be filled completely
+            int wanted = conn->compress ? MAX_RAW_SIZE / 2 : MAX_PACK_SIZE;
+            if (!eof && pending < wanted) {
+                memmove(stage, stage + start, pending);
+                start = 0;
+                if (stage_data(producer, arg, stage, &pending, &eof, wanted) == -1) {
+                    free(stage);
+                    free(rudp);
+                    return -1;
+                }
+            }
+            window = stage + start;
+            available = pending;
+        }
+
         memset(rudp, 0, sizeof(RUDP_Packet));
-        rudp->sequalNum = i;
+        rudp->messageNum = conn->send_message_num;
+        rudp->sequalNum = seq;
         rudp->flags.isData = 1;
-        if (i == packets - 1 && last_pack_size == 0) {
-            rudp->flags.fin = 1;
-        }
-        memcpy(rudp->data, data + i * MAX_PACK_SIZE, MAX_PACK_SIZE);
-        rudp->length = MAX_PACK_SIZE;
-        rudp->checksum = calculate_checksum(rudp);
-        
-        // Send the packet and wait for acknowledgment
-        do {
-            int send_data = sendto(socket, rudp, sizeof(RUDP_Packet), 0, NULL, 0);
-            if (send_data == -1) {
-                perror("can't send the data");
+        int used = fill_payload(conn, rudp, window, available < MAX_RAW_SIZE ? (int)available : MAX_RAW_SIZE);
+        offset += used;
+        start += used;
+        pending -= used;
+        // The packet took everything staged: peek for the end of the stream with a single
+        // call, so a stream that fills its last packet exactly is not followed by an empty one
+        if (producer != NULL && pending == 0 && !eof) {
+            start = 0;
+            if (stage_data(producer, arg, stage, &pending, &eof, 1) == -1) {
+                free(stage);
                 free(rudp);
                 return -1;
             }
-        } while (waiting_ack(socket, i, clock(), 1) <= 0);
-    }
-    
-    // Handle the last packet
-    if (last_pack_size > 0) {
-        memset(rudp, 0, sizeof(RUDP_Packet));
-        rudp->sequalNum = packets;
-        rudp->flags.isData = 1;
-        rudp->flags.fin = 1;
-        memcpy(rudp->data, data + (packets * MAX_PACK_SIZE), last_pack_size);
-        rudp->length = last_pack_size;
+        }
+        rudp->flags.fin = eof && (producer != NULL ? pending == 0 : offset == size);
         rudp->checksum = calculate_checksum(rudp);
-        while (waiting_ack(socket, packets, clock(), 1) <= 0) {
-            int last_pack = sendto(socket, rudp, sizeof(RUDP_Packet), 0, NULL, 0);
-            if (last_pack == -1) {
-                perror("can't send the last packet");
+
+        // Send the packet and wait for acknowledgment
+        int res = send_segment(socket, rudp, policy, deadline);
+        if (res == -1) {
+            free(stage);
+            free(rudp);
+            return -1;
+        }
+        if (res == 0) {
+            // Abandoned: an expired message is dropped whole, otherwise only this segment
+            delivered = 0;
+            int fin = rudp->flags.fin || policy->mode == RUDP_TIMED;
+            if (send_forward(socket, rudp, conn->send_message_num, seq_next(seq), fin) == -1) {
+                free(stage);
                 free(rudp);
                 return -1;
             }
+            if (fin) {
+                break;
+            }
         }
-    }
-    
+        seq = seq_next(seq);
+    } while (!rudp->flags.fin);
+    conn->send_message_num++;
+
     // Free the allocated memory for the RUDP packet
+    free(stage);
     free(rudp);
 
-    return 1;
+    *sent = offset;
+    return delivered;
+}
+
+int rudp_send(int socket, const char *data, int size) {
+    return rudp_send_ex(socket, data, size, NULL);
+}
+
+int rudp_send_ex(int socket, const char *data, int size, const RUDP_Policy *policy) {
+    int64_t sent;
+    if (size <= 0) {
+        return 1;  // Nothing to send
+    }
+    return send_message(socket, data, size, NULL, NULL, policy, &sent);
+}
+
+int64_t rudp_send_stream(int socket, rudp_producer_fn producer, void *arg, const RUDP_Policy *policy) {
+    int64_t sent;
+    if (producer == NULL) {
+        return -1;
+    }
+    if (send_message(socket, NULL, 0, producer, arg, policy, &sent) == -1) {
+        return -1;
+    }
+    return sent;
+}
+
+// Position in an iovec list read by iov_producer
+typedef struct IovCursor {
+    const struct iovec *iov;  // Remaining buffers
+    int iovcnt;               // Number of remaining buffers
+    size_t offset;            // Bytes of the first buffer already produced
+} IovCursor;
+
+static int64_t iov_producer(void *arg, char *buf, size_t max) {
+    IovCursor *cursor = (IovCursor *)arg;
+    size_t produced = 0;
+    while (produced < max && cursor->iovcnt > 0) {
+        size_t left = cursor->iov->iov_len - cursor->offset;
+        size_t chunk = left < max - produced ? left : max - produced;
+        memcpy(buf + produced, (const char *)cursor->iov->iov_base + cursor->offset, chunk);
+        produced += chunk;
+        cursor->offset += chunk;
+        if (cursor->offset == cursor->iov->iov_len) {
+            cursor->iov++;
+            cursor->iovcnt--;
+            cursor->offset = 0;
+        }
+    }
+    return (int64_t)produced;
 }
 
-// Global variable to track the sequence number
-int seq_number = 0;
+int64_t rudp_send_iov(int socket, const struct iovec *iov, int iovcnt, const RUDP_Policy *policy) {
+    IovCursor cursor = { iov, iovcnt, 0 };
+    if (iov == NULL || iovcnt < 0) {
+        return -1;
+    }
+    return rudp_send_stream(socket, iov_producer, &cursor, policy);
+}
+
+int64_t rudp_receive_stream(int socket, rudp_consumer_fn consumer, void *arg, int *complete) {
+    int64_t total = 0;
+    int idle = 0;
+    if (complete != NULL) {
+        *complete = 1;
+    }
+    while (1) {
+        char *buffer = NULL;
+        int size = 0;
+        int res = rudp_receive(socket, &buffer, &size);
+        if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) && ++idle < STREAM_IDLE_LIMIT) {
+            continue;  // A slow producer on the sending side, keep waiting
+        }
+        if (res < 0) {
+            return -1;  // Failed, or the sender closed before the end of the stream
+        }
+        idle = 0;
+        // The sender abandoned data, skipped here or at the end of the message
+        if (complete != NULL && (res == 2 || (res == 5 && buffer == NULL))) {
+            *complete = 0;
+        }
+        if (res == 1 || res == 5) {
+            if (size > 0 && consumer(arg, buffer, size) != 0) {
+                free(buffer);
+                return -1;
+            }
+            total += size;
+            free(buffer);
+            if (res == 5) {
+                return total;
+            }
+        }
+    }
+}
 
 int rudp_receive(int socket, char **buffer, int *size) {
+    Connection *conn = connection_of(socket);
+    if (conn == NULL) {
+        perror("Invalid socket");
+        return -1;
+    }
     // Allocate memory for the RUDP packet
     RUDP_Packet *rudp = malloc(sizeof(RUDP_Packet));
     if (rudp == NULL) {
@@ -110,14 +551,14 @@ int rudp_receive(int socket, char **buffer, int *size) {
 
     timeout.tv_sec = 5;  // Set timeout to 5 seconds
     timeout.tv_usec = 0;
-    if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+    if (net_set_timeout(socket, &timeout) < 0) {
         perror("Error setting timeout");
         free(rudp);
         return -1;
     }
 
     // Receive packet from socket
-    if (recvfrom(socket, rudp, sizeof(RUDP_Packet) - 1, 0, NULL, 0) == -1) {
+    if (net_recv(socket, rudp, sizeof(RUDP_Packet), NULL, NULL) == -1) {
         perror("Failed to receive data");
         free(rudp);
         return -1;
@@ -126,7 +567,7 @@ int rudp_receive(int socket, char **buffer, int *size) {
     // Reset timeout value for the socket
     timeout.tv_sec = 0;  // Set timeout to 0 seconds
     timeout.tv_usec = 0;
-    if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+    if (net_set_timeout(socket, &timeout) < 0) {
         perror("Error resetting timeout");
         free(rudp);
         return -1;
@@ -151,49 +592,74 @@ int rudp_receive(int socket, char **buffer, int *size) {
         return 0;
     }
     
+    // Handle forward-sequence marker for abandoned data
+    if (rudp->flags.isFwd == 1) {
+        int fin = rudp->flags.fin;
+        int next = rudp->sequalNum;
+        int message = rudp->messageNum;
+        free(rudp);
+        *buffer = NULL;
+        *size = 0;
+        // A marker of a message that already ended, retransmitted after its ack was lost
+        if (message != conn->message_number) {
+            return 0;
+        }
+        if (fin == 1) {
+            conn->seq_number = 0;
+            conn->message_number++;
+            // Reset timeout value for the socket
+            timeout.tv_sec = 0;  // Set timeout to 0 seconds
+            timeout.tv_usec = 0;
+            if (net_set_timeout(socket, &timeout) < 0) {
+                perror("Error resetting timeout");
+                return -1;
+            }
+            return 5;
+        }
+        // Nothing was skipped if the abandoned segment arrived and only its ack was lost
+        if (!seq_after(next, conn->seq_number)) {
+            return 0;
+        }
+        conn->seq_number = next;
+        return 2;
+    }
+
     // Handle data packet
-    if (rudp->sequalNum == seq_number) {
+    if (rudp->sequalNum == conn->seq_number && rudp->messageNum == conn->message_number) {
         if (rudp->sequalNum == 0 && rudp->flags.isData == 1) {
             // Set timeout for subsequent data packets
             timeout.tv_sec = 1;  // Set timeout to 5 seconds
             timeout.tv_usec = 0;
-            if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+            if (net_set_timeout(socket, &timeout) < 0) {
                 perror("Error setting timeout");
                 free(rudp);
                 return -1;
             }
         }
         if (rudp->flags.fin == 1 && rudp->flags.isData == 1) {
-            *buffer = malloc(rudp->length);
-            if (*buffer == NULL) {
-                perror("Failed to allocate memory for buffer");
+            if (copy_payload(conn, rudp, buffer, size) == -1) {
                 free(rudp);
                 return -1;
             }
-            memcpy(*buffer, rudp->data, rudp->length);
-            *size = rudp->length;
             free(rudp);
-            seq_number = 0;
+            conn->seq_number = 0;
+            conn->message_number++;
             // Reset timeout value for the socket
             timeout.tv_sec = 0;  // Set timeout to 0 seconds
             timeout.tv_usec = 0;
-            if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+            if (net_set_timeout(socket, &timeout) < 0) {
                 perror("Error resetting timeout");
                 return -1;
             }
             return 5;
         }
         if (rudp->flags.isData == 1) {
-            *buffer = malloc(rudp->length);
-            if (*buffer == NULL) {
-                perror("Failed to allocate memory for buffer");
+            if (copy_payload(conn, rudp, buffer, size) == -1) {
                 free(rudp);
                 return -1;
             }
-            memcpy(*buffer, rudp->data, rudp->length);
-            *size= rudp->length;
             free(rudp);
-            seq_number++;
+            conn->seq_number = seq_next(conn->seq_number);
             return 1;
         }
     }
@@ -211,7 +677,7 @@ int rudp_receive(int socket, char **buffer, int *size) {
         // Set timeout for subsequent packets
         timeout.tv_sec = 5;  // Set timeout to 5 seconds
         timeout.tv_usec = 0;
-        if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        if (net_set_timeout(socket, &timeout) < 0) {
             perror("Error setting timeout");
             return -1;
         }
@@ -220,22 +686,22 @@ int rudp_receive(int socket, char **buffer, int *size) {
             perror("Failed to allocate memory for RUDP packet");
             return -1;
         }
-        time_t finishing = time(NULL);
+        uint64_t finishing = rudp_now_ms();
         printf("Waiting for the statictics...\n");
 
-        while ((double)(time(NULL) - finishing) < 1) {
+        while (rudp_now_ms() - finishing < 1000) {
             memset(rudp, 0, sizeof(RUDP_Packet));
-            recvfrom(socket, rudp, sizeof(RUDP_Packet) - 1, 0, NULL, 0);
+            net_recv(socket, rudp, sizeof(RUDP_Packet), NULL, NULL);
             if (rudp->flags.fin == 1) {
                 if (sending_ack(socket, rudp) == -1) {
                     free(rudp);
                     return -1;
                 }
-                finishing = time(NULL);
+                finishing = rudp_now_ms();
             }
         }
         free(rudp);
-        close(socket);
+        net_close(socket);
         return -5;
     }
     
@@ -245,11 +711,16 @@ int rudp_receive(int socket, char **buffer, int *size) {
 
 
 int rudp_connect(int socket, const char *ip,unsigned short int port) {
+    Connection *conn = connection_of(socket);
+    if (conn == NULL) {
+        perror("Invalid socket");
+        return -1;
+    }
     // Set timeout for socket operations
 
     timeout.tv_sec = 1;
     timeout.tv_usec = 0;
-    if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+    if (net_set_timeout(socket, &timeout) < 0) {
         perror("Error setting timeout");
         return -1;
     }
@@ -266,7 +737,7 @@ int rudp_connect(int socket, const char *ip,unsigned short int port) {
     }
     
     // Connect to the remote socket
-    if (connect(socket, (struct sockaddr *)&server_address, sizeof(server_address)) == -1) {
+    if (net_connect(socket, (struct sockaddr *)&server_address, sizeof(server_address)) == -1) {
         perror("Connection failed");
         return -1;
     }
@@ -279,29 +750,31 @@ int rudp_connect(int socket, const char *ip,unsigned short int port) {
     }
     memset(rudp, 0, sizeof(RUDP_Packet));
     rudp->flags.isSyn = 1;
+    rudp->flags.isComp = compression_enabled;  // Offer payload compression
+    connection_reset(conn, 0);
 
     int attempts = 0;
     // Attempt to establish connection with retries
     while (attempts < 3) {
-        int sendRes = sendto(socket, rudp, sizeof(RUDP_Packet), 0, NULL, 0);
+        int sendRes = net_send(socket, rudp, sizeof(RUDP_Packet));
         if (sendRes == -1) {
             perror("Failed to send synchronization packet");
             free(rudp);
             return -1;
         }
         // Wait for acknowledgment packet with timeout
-        time_t start_time = time(NULL);
-        while ((time(NULL) - start_time) < 1) {
+        uint64_t start_time = rudp_now_ms();
+        while (rudp_now_ms() - start_time < 1000) {
             RUDP_Packet *recv = malloc(sizeof(RUDP_Packet));
             memset(recv, 0, sizeof(RUDP_Packet));
-            if (recvfrom(socket, recv, sizeof(RUDP_Packet), 0, NULL, 0) == -1) {
-                perror("Failed receiving the data");
-                free(rudp);
+            if (net_recv(socket, recv, sizeof(RUDP_Packet), NULL, NULL) == -1) {
+                // Timed out, retransmit the synchronization packet
                 free(recv);
-                return -1;
+                break;
             }
             // Check if valid acknowledgment received
             if (recv->flags.isSyn && recv->flags.ack) {
+                connection_reset(conn, compression_enabled && recv->flags.isComp);
                 printf("Connection established successfully\n");
                 free(rudp);
                 free(recv);
@@ -309,6 +782,7 @@ int rudp_connect(int socket, const char *ip,unsigned short int port) {
             } else {
                 printf("Invalid packet received\n");
             }
+            free(recv);
         }
         attempts++;
     }
@@ -317,62 +791,84 @@ int rudp_connect(int socket, const char *ip,unsigned short int port) {
     return 0;
 }
 
+// Answers a SYN received on a socket already connected to its sender.
+// Returns 1 on success, or -1 on failure.
+static int accept_syn(int socket, RUDP_Packet *syn) {
+    Connection *conn = connection_of(socket);
+    if (conn == NULL) {
+        perror("Invalid socket");
+        return -1;
+    }
+    RUDP_Packet *reply = malloc(sizeof(RUDP_Packet));
+    if (reply == NULL) {
+        perror("Failed to allocate memory for RUDP packet");
+        return -1;
+    }
+    memset(reply, 0, sizeof(RUDP_Packet));
+    reply->flags.isSyn = 1;
+    reply->flags.ack = 1;
+    // Accept payload compression only if both sides enabled it
+    reply->flags.isComp = compression_enabled && syn->flags.isComp;
+    connection_reset(conn, reply->flags.isComp);
+    int send_res = net_send(socket, reply, sizeof(RUDP_Packet));
+    free(reply);
+    if (send_res == -1) {
+        perror("Failed to send data");
+        return -1;
+    }
+    // Set timeout for socket operations
+    timeout.tv_sec = 5;
+    timeout.tv_usec = 0;
+    if (net_set_timeout(socket, &timeout) < 0) {
+        perror("Error setting timeout");
+        return -1;
+    }
+    return 1;
+}
+
 int rudp_accept(int socket, unsigned short int port) {
     // Initialize server address structure
     memset(&server_address, 0, sizeof(server_address));
     server_address.sin_family = AF_INET;
     server_address.sin_port = htons(port);
     server_address.sin_addr.s_addr = htonl(INADDR_ANY);
-    // Bind the socket to the specified port
-    if (bind(socket, (struct sockaddr *)&server_address, sizeof(server_address)) == -1) {
-        perror("Binding failed");
-        close(socket);
-        return -1;
+    // Bind the socket to the specified port, unless the caller already did
+    struct sockaddr_in bound;
+    socklen_t bound_len = sizeof(bound);
+    memset(&bound, 0, sizeof(bound));
+    if (net_local_address(socket, (struct sockaddr *)&bound, &bound_len) == -1 || bound.sin_port == 0) {
+        if (net_bind(socket, (struct sockaddr *)&server_address, sizeof(server_address)) == -1) {
+            perror("Binding failed");
+            net_close(socket);
+            return -1;
+        }
     }
     socklen_t len = sizeof(client_address);
     memset((char *)&client_address, 0, sizeof(client_address));
     // Receive synchronization packet from client
     RUDP_Packet *rudp = malloc(sizeof(RUDP_Packet));
     memset(rudp, 0, sizeof(RUDP_Packet));
-    if (recvfrom(socket, rudp, sizeof(RUDP_Packet) - 1, 0, (struct sockaddr *)&client_address, &len) == -1) {
+    if (net_recv(socket, rudp, sizeof(RUDP_Packet), (struct sockaddr *)&client_address, &len) == -1) {
         perror("Failed to receive data");
         free(rudp);
         return -1;
     }
     // Connect to the client
-    if (connect(socket, (struct sockaddr *)&client_address, len) == -1) {
+    if (net_connect(socket, (struct sockaddr *)&client_address, len) == -1) {
         perror("Connection failed");
         free(rudp);
         return -1;
     }
     // Send acknowledgment to client
-    if (rudp->flags.isSyn == 1) {
-        RUDP_Packet *reply = malloc(sizeof(RUDP_Packet));
-        memset(reply, 0, sizeof(RUDP_Packet));
-        reply->flags.isSyn = 1;
-        reply->flags.ack = 1;
-        int send_res = sendto(socket, reply, sizeof(RUDP_Packet), 0, NULL, 0);
-        if (send_res == -1) {
-            perror("Failed to send data");
-            free(rudp);
-            free(reply);
-            return -1;
-        }
-        // Set timeout for socket operations
-        timeout.tv_sec = 5;
-        timeout.tv_usec = 0;
-        if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-            perror("Error setting timeout");
-            return -1;
-        }
-        free(rudp);
-        free(reply);
-        return 1;
-    }
-    return 0;
+    int res = rudp->flags.isSyn == 1 ? accept_syn(socket, rudp) : 0;
+    free(rudp);
+    return res;
 }
 
 
+// Close requests sent before giving up on a receiver that stopped answering
+#define CLOSE_ATTEMPTS 10
+
 int rudp_close(int socket) {
   RUDP_Packet *temp = (RUDP_Packet*) malloc(sizeof(RUDP_Packet));
   if (temp == NULL){
@@ -383,14 +879,21 @@ int rudp_close(int socket) {
   temp->flags.fin = 1;  // Finished so closing the connection
   temp->checksum = calculate_checksum(temp);
   temp->sequalNum = -1;
-  while (waiting_ack(socket, -1, clock(), 1) <= 0) {
-    if (sendto(socket, temp, sizeof(RUDP_Packet), 0, NULL, 0) == -1) {
+  int attempts = 0;
+  while (waiting_ack(socket, -1, rudp_now_ms(), 1000) <= 0) {
+    if (attempts++ == CLOSE_ATTEMPTS) {
+      // The receiver already stopped lingering, it times out on its own
+      net_close(socket);
+      free(temp);
+      return 0;
+    }
+    if (net_send(socket, temp, sizeof(RUDP_Packet)) == -1) {
       perror("Fialed sendto when closing");
       free(temp);
       return -1;  // for error
     }
   }
-  close(socket);
+  net_close(socket);
   free(temp);
   return 1;  // succeeded to close the socket and freeing our rudp struct
 }
@@ -404,24 +907,46 @@ int calculate_checksum(RUDP_Packet *rudp) {
 }
 
 
-int waiting_ack(int socket, int sequal_num, clock_t s, clock_t t) {
+int waiting_ack(int socket, int sequal_num, uint64_t s, uint64_t t) {
+  return waiting_ack_for(socket, sequal_num, 0, 0, s, t);
+}
+
+
+static int waiting_ack_for(int socket, int sequal_num, int fwd, int message, uint64_t s, uint64_t t) {
   RUDP_Packet *temp = (RUDP_Packet*) malloc(sizeof(RUDP_Packet));
   if (temp == NULL){
     fprintf(stderr, "error allocating memory for sending ack");
     return -1;
   }
-  while ((double)(clock() - s) / CLOCKS_PER_SEC < 1) {
-    if (recvfrom(socket, temp, sizeof(RUDP_Packet) - 1, 0, NULL, 0) == -1) {
-      free(temp);
-      return -1;
+  // What is left of the wait when shorter than the receive timeout of the socket (a
+  // time-to-live running out, or a stale packet arrived) must not block for the full one
+  int limited = 0;
+  int res = -1;
+  uint64_t elapsed;
+  while ((elapsed = rudp_now_ms() - s) < t) {
+    uint64_t left = t - elapsed;
+    if (left < RETRANSMIT_MS) {
+      struct timeval tv = { (time_t)(left / 1000), (suseconds_t)(left % 1000 * 1000) };
+      if (net_set_timeout(socket, &tv) < 0) {
+        break;
+      }
+      limited = 1;
     }
-    if (temp->sequalNum == sequal_num && temp->flags.ack) {
-      free(temp);
-      return 1;
+    if (net_recv(socket, temp, sizeof(RUDP_Packet), NULL, NULL) == -1) {
+      break;
+    }
+    if (temp->sequalNum == sequal_num && temp->flags.ack && temp->flags.isFwd == fwd &&
+        temp->messageNum == message) {
+      res = 1;
+      break;
     }
   }
+  if (limited) {
+    struct timeval tv = { RETRANSMIT_MS / 1000, RETRANSMIT_MS % 1000 * 1000 };
+    net_set_timeout(socket, &tv);
+  }
   free(temp);
-  return -1;
+  return res;
 }
 
 
@@ -436,8 +961,15 @@ int sending_ack(int socket, RUDP_Packet *rudp) {
     ack->flags.ack = 1;
     ack->checksum = calculate_checksum(ack);
     ack->sequalNum = rudp->sequalNum;
+    ack->messageNum = rudp->messageNum;  // Keeps acks of the previous message from matching
+    ack->flags.isSyn = rudp->flags.isSyn;  // Lets a retransmitted SYN complete the handshake
+    ack->flags.isFwd = rudp->flags.isFwd;  // Keeps marker and data acks with the same number apart
+    if (rudp->flags.isSyn) {
+        Connection *conn = connection_of(socket);
+        ack->flags.isComp = conn != NULL && conn->compress;  // Repeat the answer to a retransmitted SYN
+    }
     // Send the acknowledgment packet
-    if (sendto(socket, ack, sizeof(RUDP_Packet), 0, NULL, 0) == -1) {
+    if (net_send(socket, ack, sizeof(RUDP_Packet)) == -1) {
         perror("Error: Failed end ack");
         free(ack);
         return -1;
@@ -445,3 +977,312 @@ int sending_ack(int socket, RUDP_Packet *rudp) {
     free(ack);
     return 1;
 }
+
+
+int rudp_set_reuseport(int socket) {
+    int enable = 1;
+    if (setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+        perror("Error setting SO_REUSEPORT");
+        return -1;
+    }
+    return 0;
+}
+
+
+int rudp_attach_cpu_steering(int socket, int groups) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    // A = cpu the packet arrived on; return A % groups as the socket index
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)groups },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    if (setsockopt(socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        perror("Error attaching steering program");
+        return -1;
+    }
+    return 0;
+#else
+    (void)socket;
+    (void)groups;
+    fprintf(stderr, "Steering program not supported on this system\n");
+    return -1;
+#endif
+}
+
+struct Shard;
+
+// Connection accepted by a sharded worker, served on its own thread
+typedef struct ShardFlow {
+    struct sockaddr_in peer;   // Sender of the connection
+    int socket;                // Socket connected to the sender
+    RUDP_Packet syn;           // Synchronization packet, answered by the connection thread
+    struct Shard *shard;       // Worker that accepted the connection
+    struct ShardFlow *next;    // Next live connection of the worker
+} ShardFlow;
+
+// State handed to every sharded receiver worker. Workers share nothing: a sender's
+// datagrams always reach the same listener, so each worker only tracks its own senders.
+typedef struct Shard {
+    int id;                  // Worker index, also the core it is pinned to
+    int socket;              // Listening reuseport socket owned by the worker
+    unsigned short int port; // Port shared by the reuseport group
+    rudp_worker_fn handler;  // Connection handler
+    void *arg;               // User argument for the handler
+    cpu_set_t cpus;          // Core of the worker, shared by its connection threads
+    pthread_mutex_t lock;    // Guards the live connections, only taken for a SYN or a connection end
+    pthread_cond_t done;     // Signalled when a connection ends
+    ShardFlow *flows;        // Live connections, so a retransmitted SYN does not open a second one
+    int active;              // Connections still being served
+    int stop;                // Set once a handler asked the worker to stop, read without the lock
+} Shard;
+
+// Creates a reuseport socket and binds it to the shared port
+static int shard_socket(unsigned short int port) {
+    int sockfd = rudp_socket();
+    if (sockfd == -1) {
+        return -1;
+    }
+    if (rudp_set_reuseport(sockfd) == -1) {
+        net_close(sockfd);
+        return -1;
+    }
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (net_bind(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        perror("Binding failed");
+        net_close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+// Opens a socket on the shared port connected to one sender. The kernel prefers a
+// connected socket over the listeners for that sender's datagrams.
+static int shard_connect(unsigned short int port, const struct sockaddr_in *peer) {
+    int sockfd = shard_socket(port);
+    if (sockfd == -1) {
+        return -1;
+    }
+    if (net_connect(sockfd, (const struct sockaddr *)peer, sizeof(*peer)) == -1) {
+        perror("Connection failed");
+        net_close(sockfd);
+        return -1;
+    }
+    // Anything queued before the connect came from other senders, drop it (sharding
+    // only runs on kernel sockets, so this can skip the transport)
+    char stray;
+    while (recv(sockfd, &stray, sizeof(stray), MSG_DONTWAIT) >= 0) {
+    }
+    return sockfd;
+}
+
+// Whether a sender already has a live connection, must hold the worker lock
+static int shard_has_flow(Shard *shard, const struct sockaddr_in *peer) {
+    for (ShardFlow *flow = shard->flows; flow != NULL; flow = flow->next) {
+        if (flow->peer.sin_addr.s_addr == peer->sin_addr.s_addr && flow->peer.sin_port == peer->sin_port) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Removes a connection from the live ones, must hold the worker lock
+static void shard_unlink(Shard *shard, ShardFlow *flow) {
+    ShardFlow **pos = &shard->flows;
+    while (*pos != flow) {
+        pos = &(*pos)->next;
+    }
+    *pos = flow->next;
+    shard->active--;
+}
+
+static void *shard_flow(void *param) {
+    ShardFlow *flow = (ShardFlow *)param;
+    Shard *shard = flow->shard;
+
+    // Answer the SYN here so the connection state lives on this thread
+    int res = 0;
+    if (accept_syn(flow->socket, &flow->syn) == 1) {
+        // The handler owns the connected socket from here on
+        res = shard->handler(flow->socket, shard->id, shard->arg);
+    } else {
+        net_close(flow->socket);
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    shard_unlink(shard, flow);
+    if (res < 0) {
+        __atomic_store_n(&shard->stop, 1, __ATOMIC_RELAXED);
+    }
+    pthread_cond_broadcast(&shard->done);
+    pthread_mutex_unlock(&shard->lock);
+    free(flow);
+    return NULL;
+}
+
+static void *shard_worker(void *param) {
+    Shard *shard = (Shard *)param;
+
+    // Pin the worker to its own core, its connection threads inherit it
+    if (pthread_setaffinity_np(pthread_self(), sizeof(shard->cpus), &shard->cpus) != 0) {
+        fprintf(stderr, "Worker %d: failed to pin to core\n", shard->id);
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setaffinity_np(&attr, sizeof(shard->cpus), &shard->cpus);
+
+    // Wake up every second to notice a stop request
+    struct timeval tick = { 1, 0 };
+    if (net_set_timeout(shard->socket, &tick) < 0) {
+        perror("Error setting timeout");
+        shard->stop = 1;
+    }
+
+    RUDP_Packet *syn = malloc(sizeof(RUDP_Packet));
+    if (syn == NULL) {
+        perror("Failed to allocate memory for RUDP packet");
+        shard->stop = 1;
+    }
+    while (!__atomic_load_n(&shard->stop, __ATOMIC_RELAXED)) {
+        struct sockaddr_in peer;
+        socklen_t len = sizeof(peer);
+        memset(&peer, 0, sizeof(peer));
+        memset(syn, 0, sizeof(RUDP_Packet));
+        if (net_recv(shard->socket, syn, sizeof(RUDP_Packet), (struct sockaddr *)&peer, &len) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                continue;
+            }
+            perror("Failed to receive data");
+            break;
+        }
+
+        // Ignore stray packets, and SYNs a connected sender retransmitted before its
+        // connection took over
+        if (syn->flags.isSyn != 1) {
+            continue;
+        }
+        pthread_mutex_lock(&shard->lock);
+        int known = shard_has_flow(shard, &peer);
+        pthread_mutex_unlock(&shard->lock);
+        if (known) {
+            continue;
+        }
+
+        ShardFlow *flow = malloc(sizeof(ShardFlow));
+        if (flow == NULL) {
+            perror("Failed to allocate memory for connection");
+            continue;
+        }
+        flow->socket = shard_connect(shard->port, &peer);
+        if (flow->socket == -1) {
+            free(flow);
+            continue;
+        }
+        flow->peer = peer;
+        flow->syn = *syn;
+        flow->shard = shard;
+
+        pthread_mutex_lock(&shard->lock);
+        flow->next = shard->flows;
+        shard->flows = flow;
+        shard->active++;
+        pthread_mutex_unlock(&shard->lock);
+
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, shard_flow, flow) != 0) {
+            fprintf(stderr, "Worker %d: failed to start connection thread\n", shard->id);
+            pthread_mutex_lock(&shard->lock);
+            shard_unlink(shard, flow);
+            pthread_mutex_unlock(&shard->lock);
+            net_close(flow->socket);
+            free(flow);
+        }
+    }
+    free(syn);
+    pthread_attr_destroy(&attr);
+
+    // Let the connections of this worker finish before leaving the group
+    pthread_mutex_lock(&shard->lock);
+    while (shard->active > 0) {
+        pthread_cond_wait(&shard->done, &shard->lock);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    net_close(shard->socket);
+    return NULL;
+}
+
+int rudp_serve_sharded(unsigned short int port, int workers, int steer_by_cpu,
+                       rudp_worker_fn handler, void *arg) {
+    if (workers <= 0) {
+        workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (workers <= 0 || handler == NULL) {
+        fprintf(stderr, "Invalid sharded receiver configuration\n");
+        return -1;
+    }
+
+    Shard *shards = calloc(workers, sizeof(Shard));
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+    if (shards == NULL || threads == NULL) {
+        perror("Failed to allocate memory for workers");
+        free(shards);
+        free(threads);
+        return -1;
+    }
+    for (int i = 0; i < workers; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        pthread_cond_init(&shards[i].done, NULL);
+    }
+
+    // Bind all listeners up front so group index i belongs to worker i; connected
+    // sockets are bound later and never take their slots
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int bound = 0;
+    for (; bound < workers; bound++) {
+        shards[bound].id = bound;
+        shards[bound].port = port;
+        shards[bound].handler = handler;
+        shards[bound].arg = arg;
+        CPU_ZERO(&shards[bound].cpus);
+        CPU_SET(bound % (cores > 0 ? cores : 1), &shards[bound].cpus);
+        shards[bound].socket = shard_socket(port);
+        if (shards[bound].socket == -1) {
+            break;
+        }
+    }
+    int res = -1;
+    if (bound < workers || (steer_by_cpu && rudp_attach_cpu_steering(shards[0].socket, workers) == -1)) {
+        for (int i = 0; i < bound; i++) {
+            net_close(shards[i].socket);
+        }
+    } else {
+        int started = 0;
+        for (; started < workers; started++) {
+            if (pthread_create(&threads[started], NULL, shard_worker, &shards[started]) != 0) {
+                fprintf(stderr, "Failed to start worker %d\n", started);
+                break;
+            }
+        }
+        for (int i = started; i < workers; i++) {
+            net_close(shards[i].socket);
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        res = started == workers ? 0 : -1;
+    }
+
+    for (int i = 0; i < workers; i++) {
+        pthread_mutex_destroy(&shards[i].lock);
+        pthread_cond_destroy(&shards[i].done);
+    }
+    free(shards);
+    free(threads);
+    return res;
+}
@@ -0,0 +1,416 @@
+/**
+ * @file RUDP_API.h
+ * @brief Header file for the Reliable UDP (RUDP) API.
+ */
+
+#ifndef RUDP_API_H
+#define RUDP_API_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define MAX_PACK_SIZE 4000  /**< Maximum size for data packets. */
+#define MAX_RAW_SIZE (16 * MAX_PACK_SIZE)  /**< Maximum decompressed size of a data packet. */
+#define RUDP_MAX_SOCKETS 65536  /**< Socket descriptors the API can track connection state for. */
+
+/**
+ * @struct Flags
+ * @brief Struct to represent the flags in RUDP packets.
+ */
+typedef struct Flags {
+  uint8_t fin;        /**< Indicates finishing. */
+  uint8_t ack;   /**< Indicates acknowledgment. */
+  uint8_t isSyn;    /**< Indicates synchronization. */
+  uint8_t isData;      /**< Indicates data packet. */
+  uint8_t isFwd;       /**< Indicates a forward-sequence marker for abandoned data. */
+  uint8_t isComp;      /**< On SYN: compression offered/accepted. On data: payload is compressed. */
+}Flags;
+
+/**
+ * @typedef RUDP_Packet
+ * @brief Typedef for RUDP packet structure.
+ */
+typedef struct _RUDP {
+  Flags flags;     /**< Flags for the RUDP packet. */
+  uint16_t checksum;           /**< Checksum for the packet. */
+  uint16_t length;         /**< Length of data in the packet. */
+  uint16_t rawLength;      /**< Length of data once decompressed. */
+  uint16_t messageNum;     /**< Message the packet belongs to, wraps around. Echoed by acks. */
+  int sequalNum;          /**< Sequence number for the packet, wraps from INT32_MAX to 0. */
+  char data[MAX_PACK_SIZE];    /**< Data in the packet. */
+} RUDP_Packet;
+
+/**
+ * @struct RUDP_Transport
+ * @brief Datagram transport and clock used underneath the RUDP API.
+ *
+ * The default transport uses kernel UDP sockets and the monotonic clock. Every
+ * hook follows the semantics of the matching socket call (-1 and errno on failure).
+ */
+typedef struct RUDP_Transport {
+  int (*open)(void *ctx);                                                             /**< Like socket(). */
+  int (*bind)(void *ctx, int socket, const struct sockaddr *addr, socklen_t len);     /**< Like bind(). */
+  int (*connect)(void *ctx, int socket, const struct sockaddr *addr, socklen_t len);  /**< Like connect(). */
+  ssize_t (*send)(void *ctx, int socket, const void *buf, size_t len);                /**< Like send() on a connected socket. */
+  ssize_t (*recv)(void *ctx, int socket, void *buf, size_t len,
+                  struct sockaddr *from, socklen_t *fromlen);                         /**< Like recvfrom(). */
+  int (*set_timeout)(void *ctx, int socket, const struct timeval *tv);                /**< Like SO_RCVTIMEO, zero blocks. */
+  int (*close)(void *ctx, int socket);                                                /**< Like close(). */
+  int (*local_address)(void *ctx, int socket, struct sockaddr *addr, socklen_t *len); /**< Like getsockname(). */
+  uint64_t (*now_ms)(void *ctx);                                                      /**< Current time in milliseconds. */
+  void *ctx;                                                                          /**< Passed to every hook. */
+} RUDP_Transport;
+
+/**
+ * @brief Replaces the transport used by all RUDP calls.
+ * @param t Transport to install (must outlive its use), or NULL to restore kernel sockets.
+ */
+void rudp_set_transport(const RUDP_Transport *t);
+
+/**
+ * @brief Reads the clock of the installed transport.
+ * @return Current time in milliseconds.
+ */
+uint64_t rudp_now_ms();
+
+/**
+ * @brief Creates a new RUDP socket.
+ * @return File descriptor of the created socket, or -1 on failure (also when the
+ *         descriptor is not below RUDP_MAX_SOCKETS).
+ */
+int rudp_socket();
+
+/**
+ * @brief Sends data over the RUDP connection.
+ * @param socket File descriptor of the RUDP socket.
+ * @param data Pointer to the data to be sent.
+ * @param size Size of the data to be sent.
+ * @return Number of bytes sent on success, or -1 on failure.
+ */
+int rudp_send(int socket, const char *data, int size);
+
+/**
+ * @enum RUDP_Reliability
+ * @brief Delivery guarantee of a message.
+ */
+typedef enum RUDP_Reliability {
+  RUDP_RELIABLE = 0,   /**< Retransmit every segment until acknowledged. */
+  RUDP_LIMITED_RETX,   /**< Abandon a segment after max_retx retransmissions. */
+  RUDP_TIMED           /**< Abandon the rest of the message once ttl_ms has passed. */
+} RUDP_Reliability;
+
+/**
+ * @struct RUDP_Policy
+ * @brief Per-message reliability policy.
+ */
+typedef struct RUDP_Policy {
+  RUDP_Reliability mode;  /**< Delivery guarantee. */
+  int max_retx;           /**< Retransmissions per segment for RUDP_LIMITED_RETX. */
+  uint64_t ttl_ms;        /**< Message lifetime for RUDP_TIMED, from the start of the send. */
+} RUDP_Policy;
+
+/**
+ * @brief Sends data over the RUDP connection with a reliability policy.
+ *
+ * Abandoned data is replaced by a forward-sequence marker so the receiver skips
+ * the gap instead of stalling. The marker is retransmitted until acknowledged, so a
+ * timed send can return after its ttl_ms, by a retransmission timeout per lost marker.
+ * @param socket File descriptor of the RUDP socket.
+ * @param data Pointer to the data to be sent.
+ * @param size Size of the data to be sent.
+ * @param policy Reliability policy, or NULL for fully reliable.
+ * @return 1 if everything was delivered, 0 if some data was abandoned, or -1 on failure.
+ */
+int rudp_send_ex(int socket, const char *data, int size, const RUDP_Policy *policy);
+
+/**
+ * @typedef rudp_producer_fn
+ * @brief Supplies the next chunk of a streamed message.
+ * @param arg User argument passed to rudp_send_stream.
+ * @param buf Buffer to fill.
+ * @param max Capacity of the buffer.
+ * @return Number of bytes written (at most max, more fails the send), 0 at the end of the
+ *         stream, or -1 on failure.
+ */
+typedef int64_t (*rudp_producer_fn)(void *arg, char *buf, size_t max);
+
+/**
+ * @typedef rudp_consumer_fn
+ * @brief Takes the next chunk of a streamed message.
+ * @param arg User argument passed to rudp_receive_stream.
+ * @param data Received bytes, only valid during the call.
+ * @param len Number of received bytes.
+ * @return 0 to continue, or nonzero to abort the stream.
+ */
+typedef int (*rudp_consumer_fn)(void *arg, const char *data, size_t len);
+
+/**
+ * @brief Sends one message of any length, pulling the data from a producer as the
+ *        window opens so memory use stays bounded (MAX_RAW_SIZE bytes of staging).
+ * @param socket File descriptor of the RUDP socket.
+ * @param producer Called for more data until it returns 0.
+ * @param arg User argument for the producer.
+ * @param policy Reliability policy, or NULL for fully reliable.
+ * @return Number of bytes taken from the producer (abandoned ones included), or -1 on failure.
+ */
+int64_t rudp_send_stream(int socket, rudp_producer_fn producer, void *arg, const RUDP_Policy *policy);
+
+/**
+ * @brief Sends the concatenation of several buffers as one message.
+ * @param socket File descriptor of the RUDP socket.
+ * @param iov Buffers to send, in order.
+ * @param iovcnt Number of buffers.
+ * @param policy Reliability policy, or NULL for fully reliable.
+ * @return Number of bytes sent, or -1 on failure.
+ */
+int64_t rudp_send_iov(int socket, const struct iovec *iov, int iovcnt, const RUDP_Policy *policy);
+
+/**
+ * @brief Receives one message of any length, handing each packet to a consumer.
+ * @param socket File descriptor of the RUDP socket.
+ * @param consumer Called with the data of every packet, in order.
+ * @param arg User argument for the consumer.
+ * @param complete Set to 1 if the whole message arrived, or 0 if the sender abandoned
+ *        some of it (see rudp_send_ex). May be NULL.
+ * @return Number of bytes received, or -1 on failure or if the sender closed mid-stream.
+ */
+int64_t rudp_receive_stream(int socket, rudp_consumer_fn consumer, void *arg, int *complete);
+
+/**
+ * @brief Receives data over the RUDP connection.
+ * @param socket File descriptor of the RUDP socket.
+ * @param buffer Pointer to the buffer to store received data.
+ * @param size Pointer to the variable to store the length of received data.
+ * @return 1 for a data packet, 5 for the last packet of a message (empty, with a NULL
+ *         buffer, when its end was abandoned), 2 when the sender skipped abandoned data,
+ *         0 for control or out of order packets, -5 when the sender closed the
+ *         connection, or -1 on failure.
+ */
+int rudp_receive(int socket, char **buffer, int *size);
+
+/**
+ * @brief Closes the RUDP socket.
+ * @param socket File descriptor of the RUDP socket.
+ * @return 1 on success, 0 if the receiver never acknowledged the close (the socket
+ *         is closed anyway), or -1 on failure.
+ */
+int rudp_close(int socket);
+
+/**
+ * @brief Connects to a remote RUDP socket.
+ * @param socket File descriptor of the RUDP socket.
+ * @param ip IP address of the remote socket.
+ * @param port Port number of the remote socket.
+ * @return 1 on success, 0 on failure.
+ */
+int rudp_connect(int socket, const char *ip,  unsigned short int port);
+
+/**
+ * @brief Accepts incoming connection requests on a socket.
+ * @param sockfd File descriptor of the listening socket.
+ * @param port Port number to bind the socket to.
+ * @return 1 on success, 0 on failure.
+ */
+int rudp_accept(int sockfd,  unsigned short int port);
+
+/**
+ * @brief Calculates the checksum for the given RUDP packet.
+ * @param rudp Pointer to the RUDP packet for which the checksum is calculated.
+ * @return The checksum value.
+ */
+int calculate_checksum(RUDP_Packet *rudp);
+
+/**
+ * @brief Waits for an acknowledgment packet.
+ * @param socket File descriptor of the RUDP socket.
+ * @param seq_num Expected sequence number of the acknowledgment packet.
+ * @param start_time Start time of the waiting period, from rudp_now_ms().
+ * @param timeout Timeout value for waiting, in milliseconds.
+ * @return 1 if acknowledgment received, 0 if timeout reached, or -1 on error.
+ */
+int waiting_ack(int socket, int seq_num, uint64_t start_time, uint64_t timeout);
+
+/**
+ * @brief Sends an acknowledgment packet.
+ * @param socket File descriptor of the RUDP socket.
+ * @param rudp Pointer to the RUDP packet for which the acknowledgment is sent.
+ * @return 1 on success, or -1 on failure.
+ */
+int sending_ack(int socket, RUDP_Packet *rudp);
+
+/**
+ * @typedef rudp_worker_fn
+ * @brief Connection handler run by a sharded receiver worker.
+ * @param socket File descriptor of the accepted RUDP connection. The handler owns it
+ *               (rudp_receive already closes it when the sender disconnects).
+ * @param worker Index of the worker thread that accepted the connection.
+ * @param arg User argument passed to rudp_serve_sharded.
+ * @return 0 to keep accepting connections on this worker, negative to stop the worker
+ *         once its other connections are done.
+ */
+typedef int (*rudp_worker_fn)(int socket, int worker, void *arg);
+
+/**
+ * @brief Enables SO_REUSEPORT so several sockets can bind the same port.
+ * @param socket File descriptor of the RUDP socket (must not be bound yet).
+ * @return 0 on success, or -1 on failure.
+ */
+int rudp_set_reuseport(int socket);
+
+/**
+ * @brief Attaches a BPF program that steers incoming flows to the reuseport socket
+ *        whose index matches the CPU the packet was received on.
+ *
+ * Sockets are indexed in bind order and the kernel moves the last socket into the
+ * slot of a closed one, so the first groups sockets bound must stay open. Sockets
+ * bound after them, such as connected per-flow sockets, never take their slots.
+ * @param socket File descriptor of any bound socket in the reuseport group.
+ * @param groups Number of listening sockets, bound first in the reuseport group.
+ * @return 0 on success, or -1 on failure.
+ */
+int rudp_attach_cpu_steering(int socket, int groups);
+
+/**
+ * @brief Runs a sharded receiver: one SO_REUSEPORT listening socket per worker thread,
+ *        each thread pinned to its own core and owning its connections.
+ *
+ * Every accepted sender gets its own connected socket on the shared port and its own
+ * handler thread pinned to the core of the accepting worker, so a worker keeps
+ * accepting while its connections are served.
+ * @param port Port number shared by all workers.
+ * @param workers Number of worker threads (0 uses one per online core).
+ * @param steer_by_cpu Nonzero to attach the CPU steering BPF program, otherwise the
+ *                     kernel hashes flows to workers.
+ * @param handler Handler called for every accepted connection.
+ * @param arg User argument passed to the handler.
+ * @return 0 once all workers stopped, or -1 on failure.
+ */
+int rudp_serve_sharded(unsigned short int port, int workers, int steer_by_cpu,
+                       rudp_worker_fn handler, void *arg);
+
+/**
+ * @struct RUDP_CompStats
+ * @brief Payload compression counters of a connection.
+ */
+typedef struct RUDP_CompStats {
+  uint64_t raw_bytes;           /**< Payload bytes before compression. */
+  uint64_t wire_bytes;          /**< Payload bytes carried by packets. */
+  uint64_t packets_compressed;  /**< Data packets sent or received compressed. */
+  uint64_t packets_raw;         /**< Data packets sent or received as is. */
+} RUDP_CompStats;
+
+/**
+ * @brief Offers (connect) or accepts (accept) payload compression on new connections.
+ * @param enabled Nonzero to enable, 0 to disable (the default).
+ */
+void rudp_set_compression(int enabled);
+
+/**
+ * @brief Tells whether a connection negotiated compression.
+ * @param socket File descriptor of the RUDP socket.
+ * @return 1 if both sides enabled compression during the handshake, 0 otherwise.
+ */
+int rudp_compression_negotiated(int socket);
+
+/**
+ * @brief Reads the compression counters of a connection, from any thread.
+ * @param socket File descriptor of the RUDP socket.
+ * @param stats Filled with the current counters, all 0 if the connection did not negotiate compression.
+ */
+void rudp_compression_stats(int socket, RUDP_CompStats *stats);
+
+/**
+ * @brief Compresses as much of the input as fits in the output (LZ4 block format).
+ * @param src Data to compress.
+ * @param size Size of the data, at most 65535 bytes.
+ * @param dst Output buffer.
+ * @param capacity Size of the output buffer.
+ * @param consumed Set to the number of input bytes encoded.
+ * @return Number of bytes written, or -1 on failure.
+ */
+int rudp_compress(const char *src, int size, char *dst, int capacity, int *consumed);
+
+/**
+ * @brief Decompresses a block produced by rudp_compress.
+ * @param src Compressed data.
+ * @param size Size of the compressed data.
+ * @param dst Output buffer.
+ * @param capacity Size of the output buffer.
+ * @return Number of bytes written, or -1 if the block is corrupt or does not fit.
+ */
+int rudp_decompress(const char *src, int size, char *dst, int capacity);
+
+/**
+ * @brief Estimates from a sample whether data is worth compressing.
+ * @param data Data to check.
+ * @param size Size of the data.
+ * @return 1 if the sampled entropy is low enough to compress, 0 otherwise.
+ */
+int rudp_compressible(const char *data, int size);
+
+/**
+ * @struct RUDP_SimConfig
+ * @brief Link model of the simulated transport.
+ */
+typedef struct RUDP_SimConfig {
+  double loss;          /**< Probability that a datagram is dropped. */
+  double reorder;       /**< Probability that a datagram is held back and overtaken. */
+  uint32_t latency_ms;  /**< One-way delivery delay. */
+  uint32_t seed;        /**< Seed of the loss and reorder generators. */
+} RUDP_SimConfig;
+
+/**
+ * @struct RUDP_SimStats
+ * @brief Counters kept by the simulated transport.
+ */
+typedef struct RUDP_SimStats {
+  uint64_t sent;       /**< Datagrams handed to the channel. */
+  uint64_t dropped;    /**< Datagrams lost by the channel. */
+  uint64_t reordered;  /**< Datagrams held back. */
+  uint64_t delivered;  /**< Datagrams received by an endpoint. */
+} RUDP_SimStats;
+
+typedef struct RUDP_Sim RUDP_Sim;
+
+/**
+ * @brief Creates in-memory lossy channels between pairs of endpoints with a virtual clock.
+ *
+ * Sockets opened while the simulator is installed are paired in order: the first two
+ * are the ends of one channel, the next two of another, up to four channels sharing
+ * the link model and the clock. Virtual time only advances when the thread that last
+ * used each open endpoint is blocked in a receive, so runs are deterministic for a
+ * given seed and take no wall-clock time. One thread may drive several endpoints, but
+ * run the two ends of a channel on separate threads.
+ * @param config Link model, or NULL for a lossless channel.
+ * @return The simulator, or NULL on failure.
+ */
+RUDP_Sim *rudp_sim_create(const RUDP_SimConfig *config);
+
+/**
+ * @brief Gets the transport that routes RUDP calls through the simulator.
+ * @param sim The simulator.
+ * @return Transport to pass to rudp_set_transport.
+ */
+const RUDP_Transport *rudp_sim_transport(RUDP_Sim *sim);
+
+/**
+ * @brief Reads the simulator counters.
+ * @param sim The simulator.
+ * @param stats Filled with the current counters.
+ */
+void rudp_sim_stats(RUDP_Sim *sim, RUDP_SimStats *stats);
+
+/**
+ * @brief Frees the simulator and any datagrams still in flight.
+ * @param sim The simulator (must no longer be installed).
+ */
+void rudp_sim_destroy(RUDP_Sim *sim);
+
+#endif 
@@ -0,0 +1,379 @@
+#include <arpa/inet.h>   // For manipulating IP addresses
+#include <pthread.h>     // For the receiver thread
+#include <stdio.h>       // For standard input/output operations
+#include <stdlib.h>      // For standard library functions
+#include <string.h>      // For string manipulation functions
+#include <sys/socket.h>  // For socket-related functions
+#include <time.h>        // For time-related functions
+#include <unistd.h>      // For standard symbolic constants and types
+
+#include "RUDP_API.h"    // Header file for the Reliable UDP (RUDP) API
+
+#define RUNS 5            // Default number of transfers per workload
+#define SIZE_MB 8         // Default size of each transfer in MB
+#define MAX_WORKLOADS 8   // Upper bound for workloads read from a baseline file
+#define MAX_SENDERS 64    // Upper bound for concurrent senders of the sharded workload
+#define SETUP_US 200000   // Time given to the sharded workers to bind before senders connect
+
+/**
+ * @struct Workload
+ * @brief A benchmarked transfer pattern.
+ */
+typedef struct Workload {
+    const char *name;   /**< Name printed in the results. */
+    int text;           /**< Compressible text instead of random bytes. */
+} Workload;
+
+static const Workload workloads[] = {
+    { "random", 0 },
+    { "text", 1 },
+};
+
+/**
+ * @brief Fills a buffer with the data of a workload.
+ * @param buffer Buffer to fill.
+ * @param size Size of the buffer.
+ * @param text Nonzero for log-like text, 0 for random bytes.
+ */
+void fill_data(char *buffer, int size, int text) {
+    static const char *lines[] = {
+        "{\"level\":\"info\",\"msg\":\"request served\",\"latency_ms\":12}\n",
+        "{\"level\":\"warn\",\"msg\":\"slow upstream\",\"latency_ms\":250}\n",
+        "{\"level\":\"info\",\"msg\":\"cache hit\",\"key\":\"user:1042\"}\n",
+    };
+    srand(1);
+    for (int i = 0; i < size;) {
+        if (text) {
+            const char *line = lines[rand() % 3];
+            int len = strlen(line) < (size_t)(size - i) ? (int)strlen(line) : size - i;
+            memcpy(buffer + i, line, len);
+            i += len;
+        } else {
+            buffer[i++] = (char)(rand() % 256);
+        }
+    }
+}
+
+/**
+ * @brief Consumer that discards the received data.
+ */
+int discard(void *arg, const char *data, size_t len) {
+    (void)data;
+    *(long long *)arg += len;
+    return 0;
+}
+
+/**
+ * @brief Receiver thread: accepts one connection and drains it until the sender closes.
+ * @param arg Pointer to the bound receiver socket.
+ */
+void *receiver(void *arg) {
+    int sockfd = *(int *)arg;
+    long long received = 0;
+    if (rudp_accept(sockfd, 0) <= 0) {
+        return NULL;
+    }
+    while (rudp_receive_stream(sockfd, discard, &received, NULL) >= 0) {
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Current time in seconds.
+ */
+double now_seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @struct Sender
+ * @brief State of one sender thread of the sharded workload.
+ */
+typedef struct Sender {
+    unsigned short int port;    /**< Port of the sharded receiver. */
+    const char *data;           /**< Data to send, shared by all senders. */
+    int size;                   /**< Size of the data. */
+    int runs;                   /**< Number of transfers. */
+    int failed;                 /**< Set if the sender could not connect or send. */
+    double finish;              /**< Time the last transfer completed, before the close. */
+} Sender;
+
+/**
+ * @brief Connection handler of the sharded receiver: drains the connection until the sender closes.
+ * @param sockfd File descriptor of the accepted connection.
+ * @param worker Index of the worker that accepted it.
+ * @param arg Unused.
+ * @return 0 to keep serving connections.
+ */
+int drain_connection(int sockfd, int worker, void *arg) {
+    (void)worker;
+    (void)arg;
+    long long received = 0;
+    while (rudp_receive_stream(sockfd, discard, &received, NULL) >= 0) {
+    }
+    return 0;
+}
+
+/**
+ * @brief Sharded receiver thread, serves until the process exits.
+ * @param arg Pointer to the port and the number of workers.
+ */
+void *sharded_receiver(void *arg) {
+    int *config = (int *)arg;
+    if (rudp_serve_sharded((unsigned short int)config[0], config[1], 0, drain_connection, NULL) == -1) {
+        fprintf(stderr, "Sharded receiver failed\n");
+    }
+    return NULL;
+}
+
+/**
+ * @brief Sender thread of the sharded workload: connects and sends the data every run.
+ * @param arg Pointer to the Sender state.
+ */
+void *sender(void *arg) {
+    Sender *sender = (Sender *)arg;
+    int sockfd = rudp_socket();
+    if (sockfd == -1 || rudp_connect(sockfd, "127.0.0.1", sender->port) <= 0) {
+        sender->failed = 1;
+        return NULL;
+    }
+    for (int i = 0; i < sender->runs && !sender->failed; i++) {
+        sender->failed = rudp_send(sockfd, sender->data, sender->size) < 0;
+    }
+    sender->finish = now_seconds();
+    rudp_close(sockfd);
+    return NULL;
+}
+
+/**
+ * @brief Runs one workload over a loopback connection.
+ * @param workload Workload to run.
+ * @param data Data to send, already filled.
+ * @param size Size of the data.
+ * @param runs Number of transfers.
+ * @return Average speed in MB/s, or -1 on failure.
+ */
+double run_workload(const Workload *workload, const char *data, int size, int runs) {
+    // Bind the receiver to a free port first, rudp_accept keeps an existing binding
+    int receiver_socket = rudp_socket();
+    struct sockaddr_in address;
+    socklen_t len = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (receiver_socket == -1 || bind(receiver_socket, (struct sockaddr *)&address, len) == -1 ||
+        getsockname(receiver_socket, (struct sockaddr *)&address, &len) == -1) {
+        perror("Failed to bind the receiver");
+        return -1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, receiver, &receiver_socket) != 0) {
+        fprintf(stderr, "Failed to start the receiver\n");
+        return -1;
+    }
+
+    rudp_set_compression(workload->text);
+    int sockfd = rudp_socket();
+    if (sockfd == -1 || rudp_connect(sockfd, "127.0.0.1", ntohs(address.sin_port)) <= 0) {
+        fprintf(stderr, "Failed to connect to the receiver\n");
+        return -1;
+    }
+
+    double total_time = 0;
+    for (int i = 0; i < runs; i++) {
+        double start = now_seconds();
+        if (rudp_send(sockfd, data, size) < 0) {
+            fprintf(stderr, "Failed to send the data\n");
+            return -1;
+        }
+        total_time += now_seconds() - start;
+    }
+    rudp_close(sockfd);
+    pthread_join(thread, NULL);
+
+    return (double)size * runs / (1024 * 1024) / total_time;
+}
+
+/**
+ * @brief Runs concurrent senders against a sharded receiver on the loopback interface.
+ * @param workers Number of receiver workers.
+ * @param senders Number of sender threads, each with its own connection.
+ * @param data Data to send, already filled.
+ * @param size Size of the data.
+ * @param runs Number of transfers per sender.
+ * @return Aggregate speed of all senders in MB/s, or -1 on failure.
+ */
+double run_sharded(int workers, int senders, const char *data, int size, int runs) {
+    // Find a free port; the workers bind it with SO_REUSEPORT
+    int probe = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address;
+    socklen_t len = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (probe == -1 || bind(probe, (struct sockaddr *)&address, len) == -1 ||
+        getsockname(probe, (struct sockaddr *)&address, &len) == -1) {
+        perror("Failed to find a free port");
+        return -1;
+    }
+    close(probe);
+
+    // The workers are never stopped, they go away with the process
+    static int config[2];
+    config[0] = ntohs(address.sin_port);
+    config[1] = workers;
+    pthread_t server;
+    if (pthread_create(&server, NULL, sharded_receiver, config) != 0) {
+        fprintf(stderr, "Failed to start the sharded receiver\n");
+        return -1;
+    }
+    pthread_detach(server);
+    usleep(SETUP_US);
+
+    rudp_set_compression(0);
+    Sender state[MAX_SENDERS];
+    pthread_t threads[MAX_SENDERS];
+    int started = 0;
+    double start = now_seconds();
+    for (; started < senders; started++) {
+        state[started] = (Sender){ (unsigned short int)config[0], data, size, runs, 0, 0 };
+        if (pthread_create(&threads[started], NULL, sender, &state[started]) != 0) {
+            fprintf(stderr, "Failed to start sender %d\n", started);
+            break;
+        }
+    }
+    int failed = started < senders;
+    double finish = start;
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        failed |= state[i].failed;
+        finish = state[i].finish > finish ? state[i].finish : finish;
+    }
+    double elapsed = finish - start;
+    if (failed) {
+        fprintf(stderr, "Failed to send the data\n");
+        return -1;
+    }
+    return (double)size * runs * senders / (1024 * 1024) / elapsed;
+}
+
+/**
+ * @brief Prints the speed of a workload, compared with the baseline build when known.
+ * @param name Name of the workload.
+ * @param speed Speed in MB/s.
+ * @param baseline_names Workload names read from the baseline file.
+ * @param baseline_speeds Speeds read from the baseline file.
+ * @param baselines Number of baseline entries.
+ */
+void print_speed(const char *name, double speed, char baseline_names[][32], const double *baseline_speeds,
+                 int baselines) {
+    printf("%s %.2f MB/s", name, speed);
+    for (int b = 0; b < baselines; b++) {
+        if (strcmp(baseline_names[b], name) == 0 && baseline_speeds[b] > 0) {
+            printf(" (%.2fx baseline %.2f MB/s)", speed / baseline_speeds[b], baseline_speeds[b]);
+        }
+    }
+    printf("\n");
+}
+
+/**
+ * @brief Main function of the loopback benchmark.
+ *
+ * Usage: RUDP_Bench [-n runs] [-s size_mb] [-c baseline_file] [-w workers [-t senders]]
+ * Prints one "<workload> <MB/s>" line per workload. With -c, each line is compared
+ * against the same workload in a file holding the output of a baseline build. With -w,
+ * a last workload runs the senders (one per worker by default) at once against a
+ * sharded receiver with that many workers and reports their aggregate speed.
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line argument strings.
+ * @return 0 on successful execution, 1 on failure.
+ */
+int main(int argc, char *argv[]) {
+    int runs = RUNS;
+    int size_mb = SIZE_MB;
+    const char *baseline_file = NULL;
+    int workers = 0;
+    int senders = 0;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-n") == 0) {
+            runs = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            size_mb = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-c") == 0) {
+            baseline_file = argv[i + 1];
+        } else if (strcmp(argv[i], "-w") == 0) {
+            workers = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            senders = atoi(argv[i + 1]);
+        } else {
+            runs = 0;  // Unknown option, print the usage
+            break;
+        }
+    }
+    if (senders == 0) {
+        senders = workers;
+    }
+    if (argc % 2 == 0 || runs <= 0 || size_mb <= 0 || size_mb > 1024 || workers < 0 ||
+        senders < 0 || senders > MAX_SENDERS || (senders > 0 && workers == 0)) {
+        printf("Usage: %s [-n runs] [-s size_mb] [-c baseline_file] [-w workers [-t senders]]\n", argv[0]);
+        return 1;
+    }
+
+    // Speeds of the baseline build, by workload name
+    char baseline_names[MAX_WORKLOADS][32];
+    double baseline_speeds[MAX_WORKLOADS];
+    int baselines = 0;
+    if (baseline_file != NULL) {
+        FILE *fp = fopen(baseline_file, "r");
+        if (fp == NULL) {
+            perror("Failed to open the baseline file");
+            return 1;
+        }
+        // Skip the connection messages printed by the library
+        char line[256];
+        while (baselines < MAX_WORKLOADS && fgets(line, sizeof(line), fp) != NULL) {
+            if (sscanf(line, "%31s %lf MB/s", baseline_names[baselines], &baseline_speeds[baselines]) == 2) {
+                baselines++;
+            }
+        }
+        fclose(fp);
+    }
+
+    int size = size_mb * 1024 * 1024;
+    char *data = malloc(size);
+    if (data == NULL) {
+        perror("Failed to allocate memory for the data");
+        return 1;
+    }
+
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        fill_data(data, size, workloads[w].text);
+        double speed = run_workload(&workloads[w], data, size, runs);
+        if (speed < 0) {
+            free(data);
+            return 1;
+        }
+        print_speed(workloads[w].name, speed, baseline_names, baseline_speeds, baselines);
+    }
+
+    if (workers > 0) {
+        // Named after its configuration, so it is only compared with the same one
+        char name[32];
+        snprintf(name, sizeof(name), "sharded_w%d_t%d", workers, senders);
+        fill_data(data, size, 0);
+        double speed = run_sharded(workers, senders, data, size, runs);
+        if (speed < 0) {
+            free(data);
+            return 1;
+        }
+        print_speed(name, speed, baseline_names, baseline_speeds, baselines);
+    }
+
+    free(data);
+    return 0;
+}
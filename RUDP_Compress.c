@@ -0,0 +1,194 @@
+/**
+ * @file RUDP_Compress.c
+ * @brief Fast LZ77 payload codec using the LZ4 block format, and the entropy check.
+ */
+#include "RUDP_API.h"
+#include <string.h>     // For memcpy and memset
+
+#define LZ_HASH_LOG 12                  // Hash table of 4096 positions
+#define LZ_MIN_MATCH 4                  // Shortest match worth encoding
+#define LZ_MF_LIMIT 12                  // No match may start in the last 12 bytes
+#define LZ_LAST_LITERALS 5              // The last 5 bytes are always literals
+#define LZ_MAX_OFFSET 65535             // Offsets are stored on 2 bytes
+#define ENTROPY_SAMPLES 1024            // Bytes sampled by the entropy check
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+// Bytes needed after the token to store a length that overflows its 4 token bits
+static int lz_extra(int len) {
+    return len >= 15 ? (len - 15) / 255 + 1 : 0;
+}
+
+static uint8_t *lz_write_length(uint8_t *op, int len) {
+    for (len -= 15; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+int rudp_compress(const char *src, int size, char *dst, int capacity, int *consumed) {
+    const uint8_t *in = (const uint8_t *)src;
+    uint8_t *out = (uint8_t *)dst;
+    uint32_t table[1 << LZ_HASH_LOG];
+    int ip = 0, anchor = 0, op = 0;
+    int misses = 0;
+
+    memset(table, 0, sizeof(table));
+    // Every sequence keeps one byte free for the token of the final literals
+    capacity--;
+    if (capacity < 0) {
+        return -1;
+    }
+
+    while (ip < size - LZ_MF_LIMIT) {
+        uint32_t seq = read32(in + ip);
+        uint32_t h = lz_hash(seq);
+        int ref = (int)table[h] - 1;
+        table[h] = ip + 1;
+        if (ref < 0 || ip - ref > LZ_MAX_OFFSET || read32(in + ref) != seq) {
+            // Skip faster through data that does not match
+            ip += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+
+        // Extend the match backwards into pending literals, then forwards
+        while (ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1]) {
+            ip--;
+            ref--;
+        }
+        int match = LZ_MIN_MATCH;
+        while (ip + match < size - LZ_LAST_LITERALS && in[ip + match] == in[ref + match]) {
+            match++;
+        }
+
+        int lit = ip - anchor;
+        int need = 1 + lz_extra(lit) + lit + 2 + lz_extra(match - LZ_MIN_MATCH);
+        if (op + need > capacity) {
+            break;  // Output is full, the rest goes into the next packet
+        }
+
+        uint8_t *token = out + op++;
+        uint8_t *p = out + op;
+        *token = (uint8_t)((lit < 15 ? lit : 15) << 4);
+        if (lit >= 15) {
+            p = lz_write_length(p, lit);
+        }
+        memcpy(p, in + anchor, lit);
+        p += lit;
+        *p++ = (uint8_t)((ip - ref) & 0xFF);
+        *p++ = (uint8_t)((ip - ref) >> 8);
+        int ml = match - LZ_MIN_MATCH;
+        *token |= (uint8_t)(ml < 15 ? ml : 15);
+        if (ml >= 15) {
+            p = lz_write_length(p, ml);
+        }
+        op = (int)(p - out);
+
+        ip += match;
+        anchor = ip;
+    }
+
+    // Final literals, as many as still fit
+    int avail = capacity - op;  // The final token was reserved above
+    int lit = size - anchor;
+    if (lit > avail) {
+        lit = avail;
+    }
+    while (lit > 0 && lit + lz_extra(lit) > avail) {
+        lit--;
+    }
+    uint8_t *p = out + op;
+    *p++ = (uint8_t)((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15) {
+        p = lz_write_length(p, lit);
+    }
+    memcpy(p, in + anchor, lit);
+    p += lit;
+
+    *consumed = anchor + lit;
+    return (int)(p - out);
+}
+
+int rudp_decompress(const char *src, int size, char *dst, int capacity) {
+    const uint8_t *in = (const uint8_t *)src;
+    uint8_t *out = (uint8_t *)dst;
+    int ip = 0, op = 0;
+
+    while (ip < size) {
+        int token = in[ip++];
+        int lit = token >> 4;
+        if (lit == 15) {
+            int b;
+            do {
+                if (ip >= size) {
+                    return -1;
+                }
+                b = in[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (ip + lit > size || op + lit > capacity) {
+            return -1;
+        }
+        memcpy(out + op, in + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == size) {
+            break;  // The last sequence has no match
+        }
+
+        if (ip + 2 > size) {
+            return -1;
+        }
+        int offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        int match = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15) {
+            int b;
+            do {
+                if (ip >= size) {
+                    return -1;
+                }
+                b = in[ip++];
+                match += b;
+            } while (b == 255);
+        }
+        if (offset == 0 || offset > op || op + match > capacity) {
+            return -1;
+        }
+        // Byte by byte, matches may overlap their own output
+        for (int i = 0; i < match; i++, op++) {
+            out[op] = out[op - offset];
+        }
+    }
+    return op;
+}
+
+int rudp_compressible(const char *data, int size) {
+    if (size < LZ_MF_LIMIT + LZ_MIN_MATCH) {
+        return 0;
+    }
+    // Collision entropy of a strided sample: sum(p^2) < 1/128 means above 7 bits per byte
+    uint32_t counts[256];
+    memset(counts, 0, sizeof(counts));
+    int samples = size < ENTROPY_SAMPLES ? size : ENTROPY_SAMPLES;
+    int stride = size / samples;
+    for (int i = 0; i < samples; i++) {
+        counts[(uint8_t)data[i * stride]]++;
+    }
+    uint64_t collisions = 0;
+    for (int i = 0; i < 256; i++) {
+        collisions += (uint64_t)counts[i] * counts[i];
+    }
+    return collisions * 128 >= (uint64_t)samples * samples;
+}
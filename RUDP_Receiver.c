@@ -11,6 +11,43 @@
 
 #define PORT 1234        // Default port number
 #define MAX_SIZE 1024*1024*2 // Size of the random data to generate (2MB)
+#define MAX_WORKERS 256      // Upper bound for sharded receiver workers
+
+/**
+ * @brief Connection handler for the sharded receiver mode, runs on its own thread.
+ * @param sockfd File descriptor of the accepted connection.
+ * @param worker Index of the worker that accepted it.
+ * @param arg Unused.
+ * @return 0 to keep serving connections.
+ */
+int receive_connection(int sockfd, int worker, void *arg) {
+    (void)arg;
+    char *recv_data = NULL;
+    int data_len = 0;
+    int data_flag = 0;
+    long long received = 0;
+    // Wall-clock time, connections share the process so its CPU time would be meaningless
+    struct timespec start, finish;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do {
+        data_flag = rudp_receive(sockfd, &recv_data, &data_len);
+        if (data_flag == 1 || data_flag == 5) {
+            received += data_len;
+            free(recv_data);
+            recv_data = NULL;
+        }
+    } while (data_flag >= 0);
+
+    if (data_flag == -1) {
+        close(sockfd);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    double elapsed_time = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Worker #%d: connection done, %lld bytes (%.2fms)\n",
+           worker, received, elapsed_time * 1000);
+    return 0;
+}
 
 /**
  * @brief Main function to receive data using the RUDP protocol.
@@ -20,16 +57,33 @@
  */
 int main(int argc, char *argv[]) {
     // Check if the correct number of command-line arguments is provided
-    if (strcmp(argv[1], "-p") != 0 || argc != 3  ) {
+    if ((argc != 3 && argc != 5) || strcmp(argv[1], "-p") != 0 || (argc == 5 && strcmp(argv[3], "-w") != 0)) {
         printf("Invalid  input\n");
         return -1;
     }
 
     printf("Starting Receiver...\n");
 
+    // Accept payload compression when a sender offers it
+    rudp_set_compression(1);
+
     // Extract port number from command-line argument
     int port = atoi(argv[2]);  
 
+    // Sharded mode: one SO_REUSEPORT socket and pinned thread per worker
+    if (argc == 5) {
+        int workers = atoi(argv[4]);
+        if (workers == 0) {
+            workers = (int)sysconf(_SC_NPROCESSORS_ONLN);  // One worker per core
+        }
+        if (workers <= 0 || workers > MAX_WORKERS) {
+            printf("Invalid number of workers\n");
+            return -1;
+        }
+        printf("Serving port %d with %d sharded workers...\n", port, workers);
+        return rudp_serve_sharded(port, workers, 0, receive_connection, NULL);
+    }
+
     // Create a socket for receiving data
     int sockfd = rudp_socket();
     if (sockfd == -1) {
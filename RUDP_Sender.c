@@ -44,10 +44,15 @@ int main(int argc, char *argv[]) {
     char *ip;
     int port_number;
 
-    if (argc != 5 || strcmp(argv[1], "-ip") != 0 || strcmp(argv[3], "-p") != 0) {
+    if ((argc != 5 && argc != 6) || strcmp(argv[1], "-ip") != 0 || strcmp(argv[3], "-p") != 0 ||
+        (argc == 6 && strcmp(argv[5], "-z") != 0)) {
         printf("invalid  input\n");
         return 1;
     }
+    // Offer payload compression to the receiver
+    if (argc == 6) {
+        rudp_set_compression(1);
+    }
     ip = argv[2];
     char *port = argv[4];
     char *ptr;
@@ -84,6 +89,14 @@ int main(int argc, char *argv[]) {
             free(data);
             return 1;
         }
+        if (rudp_compression_negotiated(socket)) {
+            RUDP_CompStats stats;
+            rudp_compression_stats(socket, &stats);
+            printf("Compression: %llu raw bytes sent as %llu bytes (%llu/%llu packets compressed)\n",
+                   (unsigned long long)stats.raw_bytes, (unsigned long long)stats.wire_bytes,
+                   (unsigned long long)stats.packets_compressed,
+                   (unsigned long long)(stats.packets_compressed + stats.packets_raw));
+        }
         printf("Do you want to send it again? (y/n): \n");
         scanf(" %c", &option);
     } while (option == 'y');
@@ -0,0 +1,367 @@
+/**
+ * @file RUDP_Sim.c
+ * @brief In-memory lossy datagram channel with a virtual clock, used as an RUDP transport.
+ */
+#include "RUDP_API.h"
+#include <arpa/inet.h>  // For htonl and htons
+#include <errno.h>      // For error handling
+#include <pthread.h>    // For the endpoint lock and wake-ups
+#include <stdlib.h>     // For dynamic memory allocation
+#include <string.h>     // For memcpy and memset
+
+#define SIM_ENDPOINTS 8        // Four channels, endpoint i talks to endpoint i ^ 1
+#define SIM_FD_BASE (RUDP_MAX_SOCKETS - SIM_ENDPOINTS)  // Keeps simulated sockets away from real descriptors
+
+// Datagram waiting in an endpoint queue
+typedef struct SimDatagram {
+    uint64_t deliver_at;       // Virtual time the datagram becomes readable
+    size_t len;                // Length of the payload
+    struct SimDatagram *next;  // Next datagram, queues are sorted by deliver_at
+    char data[];               // Payload
+} SimDatagram;
+
+// One end of a channel
+typedef struct SimEndpoint {
+    int opened;            // Handed out by open
+    int bound;             // Bound to a local address
+    int closed;            // Closed, no longer takes part in the clock
+    int waiting;           // Blocked in recv
+    pthread_t owner;       // Thread that last used the endpoint
+    uint64_t deadline;     // Virtual time the blocked recv times out
+    uint64_t timeout_ms;   // Receive timeout, 0 blocks
+    uint32_t rng;          // Generator for datagrams sent by this endpoint
+    SimDatagram *queue;    // Incoming datagrams
+} SimEndpoint;
+
+struct RUDP_Sim {
+    RUDP_SimConfig config;
+    RUDP_Transport transport;
+    RUDP_SimStats stats;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    uint64_t now;          // Virtual clock in milliseconds
+    int opened;            // Endpoints handed out so far
+    SimEndpoint ends[SIM_ENDPOINTS];
+};
+
+// xorshift32, one stream per sending endpoint keeps runs independent of thread timing
+static uint32_t sim_random(SimEndpoint *ep) {
+    uint32_t x = ep->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ep->rng = x;
+    return x;
+}
+
+static double sim_uniform(SimEndpoint *ep) {
+    return (double)sim_random(ep) / 4294967296.0;
+}
+
+// Looks up an endpoint, which the calling thread now drives
+static SimEndpoint *sim_endpoint(RUDP_Sim *sim, int socket) {
+    int idx = socket - SIM_FD_BASE;
+    if (idx < 0 || idx >= SIM_ENDPOINTS || !sim->ends[idx].opened || sim->ends[idx].closed) {
+        errno = EBADF;
+        return NULL;
+    }
+    sim->ends[idx].owner = pthread_self();
+    return &sim->ends[idx];
+}
+
+// Whether the thread driving an endpoint is blocked in recv, on this or another endpoint
+static int sim_blocked(RUDP_Sim *sim, const SimEndpoint *ep) {
+    for (int i = 0; i < SIM_ENDPOINTS; i++) {
+        if (sim->ends[i].waiting && pthread_equal(sim->ends[i].owner, ep->owner)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Advances the virtual clock once the threads driving every live endpoint are blocked
+ * in recv.
+ * Returns 1 if the clock moved, 0 if some endpoint can still make progress,
+ * or -1 if every endpoint waits forever.
+ */
+static int sim_advance(RUDP_Sim *sim) {
+    uint64_t next = UINT64_MAX;
+    for (int i = 0; i < SIM_ENDPOINTS; i++) {
+        SimEndpoint *ep = &sim->ends[i];
+        // Channels nobody opened yet do not hold the clock back
+        if (ep->closed || (!ep->opened && !sim->ends[i ^ 1].opened)) {
+            continue;
+        }
+        if (!ep->opened || !sim_blocked(sim, ep)) {
+            return 0;
+        }
+        if (ep->waiting && ep->deadline < next) {
+            next = ep->deadline;
+        }
+        if (ep->queue != NULL && ep->queue->deliver_at < next) {
+            next = ep->queue->deliver_at;
+        }
+    }
+    if (next == UINT64_MAX) {
+        return -1;
+    }
+    if (next <= sim->now) {
+        return 0;
+    }
+    sim->now = next;
+    pthread_cond_broadcast(&sim->wake);
+    return 1;
+}
+
+static int sim_open(void *ctx) {
+    RUDP_Sim *sim = (RUDP_Sim *)ctx;
+    pthread_mutex_lock(&sim->lock);
+    if (sim->opened == SIM_ENDPOINTS) {
+        pthread_mutex_unlock(&sim->lock);
+        errno = EMFILE;
+        return -1;
+    }
+    int idx = sim->opened++;
+    sim->ends[idx].opened = 1;
+    sim->ends[idx].owner = pthread_self();
+    pthread_cond_broadcast(&sim->wake);
+    pthread_mutex_unlock(&sim->lock);
+    return SIM_FD_BASE + idx;
+}
+
+static int sim_bind(void *ctx, int socket, const struct sockaddr *addr, socklen_t len) {
+    RUDP_Sim *sim = (RUDP_Sim *)ctx;
+    (void)addr;
+    (void)len;
+    pthread_mutex_lock(&sim->lock);
+    SimEndpoint *ep = sim_endpoint(sim, socket);
+    if (ep != NULL) {
+        ep->bound = 1;
+    }
+    pthread_mutex_unlock(&sim->lock);
+    return ep != NULL ? 0 : -1;
+}
+
+// The two ends of a channel are always connected to each other
+static int sim_connect(void *ctx, int socket, const struct sockaddr *addr, socklen_t len) {
+    RUDP_Sim *sim = (RUDP_Sim *)ctx;
+    (void)addr;
+    (void)len;
+    pthread_mutex_lock(&sim->lock);
+    int res = sim_endpoint(sim, socket) != NULL ? 0 : -1;
+    pthread_mutex_unlock(&sim->lock);
+    return res;
+}
+
+// Endpoint i is 127.0.0.1 port i + 1 once bound, port 0 before
+static void sim_address(int idx, int bound, struct sockaddr *addr, socklen_t *len) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(bound ? (unsigned short)(idx + 1) : 0);
+    memcpy(addr, &address, *len < sizeof(address) ? *len : sizeof(address));
+    *len = sizeof(address);
+}
+
+static ssize_t sim_send(void *ctx, int socket, const void *buf, size_t len) {
+    RUDP_Sim *sim = (RUDP_Sim *)ctx;
+    pthread_mutex_lock(&sim->lock);
+    SimEndpoint *ep = sim_endpoint(sim, socket);
+    if (ep == NULL) {
+        pthread_mutex_unlock(&sim->lock);
+        return -1;
+    }
+    SimEndpoint *peer = &sim->ends[(ep - sim->ends) ^ 1];
+    sim->stats.sent++;
+
+    // Draw both decisions for every datagram so the streams stay aligned
+    double lost = sim_uniform(ep);
+    double held = sim_uniform(ep);
+    uint32_t extra = sim_random(ep);
+    if (peer->closed || lost < sim->config.loss) {
+        sim->stats.dropped++;
+        pthread_mutex_unlock(&sim->lock);
+        return (ssize_t)len;
+    }
+
+    SimDatagram *dgram = malloc(sizeof(SimDatagram) + len);
+    if (dgram == NULL) {
+        pthread_mutex_unlock(&sim->lock);
+        errno = ENOBUFS;
+        return -1;
+    }
+    memcpy(dgram->data, buf, len);
+    dgram->len = len;
+    dgram->deliver_at = sim->now + sim->config.latency_ms;
+    if (held < sim->config.reorder) {
+        // Hold the datagram back long enough for later ones to overtake it
+        dgram->deliver_at += 1 + extra % (2 * sim->config.latency_ms + 2);
+        sim->stats.reordered++;
+    }
+
+    SimDatagram **pos = &peer->queue;
+    while (*pos != NULL && (*pos)->deliver_at <= dgram->deliver_at) {
+        pos = &(*pos)->next;
+    }
+    dgram->next = *pos;
+    *pos = dgram;
+
+    pthread_cond_broadcast(&sim->wake);
+    pthread_mutex_unlock(&sim->lock);
+    return (ssize_t)len;
+}
+
+static ssize_t sim_recv(void *ctx, int socket, void *buf, size_t len,
+                        struct sockaddr *from, socklen_t *fromlen) {
+    RUDP_Sim *sim = (RUDP_Sim *)ctx;
+    pthread_mutex_lock(&sim->lock);
+    SimEndpoint *ep = sim_endpoint(sim, socket);
+    if (ep == NULL) {
+        pthread_mutex_unlock(&sim->lock);
+        return -1;
+    }
+    uint64_t deadline = ep->timeout_ms ? sim->now + ep->timeout_ms : UINT64_MAX;
+
+    while (1) {
+        SimDatagram *dgram = ep->queue;
+        if (dgram != NULL && dgram->deliver_at <= sim->now) {
+            ep->queue = dgram->next;
+            sim->stats.delivered++;
+            pthread_mutex_unlock(&sim->lock);
+
+            size_t copied = dgram->len < len ? dgram->len : len;
+            memcpy(buf, dgram->data, copied);
+            free(dgram);
+            if (from != NULL && fromlen != NULL) {
+                sim_address((socket - SIM_FD_BASE) ^ 1, 1, from, fromlen);
+            }
+            return (ssize_t)copied;
+        }
+        if (sim->now >= deadline) {
+            pthread_mutex_unlock(&sim->lock);
+            errno = EAGAIN;
+            return -1;
+        }
+
+        ep->waiting = 1;
+        ep->deadline = deadline;
+        int advanced = sim_advance(sim);
+        if (advanced == 0) {
+            pthread_cond_wait(&sim->wake, &sim->lock);
+        }
+        ep->waiting = 0;
+        if (advanced == -1) {
+            // Nobody will ever send again
+            pthread_cond_broadcast(&sim->wake);
+            pthread_mutex_unlock(&sim->lock);
+            errno = ECONNRESET;
+            return -1;
+        }
+    }
+}
+
+static int sim_set_timeout(void *ctx, int socket, const struct timeval *tv) {
+    RUDP_Sim *sim = (RUDP_Sim *)ctx;
+    pthread_mutex_lock(&sim->lock);
+    SimEndpoint *ep = sim_endpoint(sim, socket);
+    if (ep != NULL) {
+        ep->timeout_ms = (uint64_t)tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+    }
+    pthread_mutex_unlock(&sim->lock);
+    return ep != NULL ? 0 : -1;
+}
+
+static int sim_close(void *ctx, int socket) {
+    RUDP_Sim *sim = (RUDP_Sim *)ctx;
+    pthread_mutex_lock(&sim->lock);
+    SimEndpoint *ep = sim_endpoint(sim, socket);
+    if (ep == NULL) {
+        pthread_mutex_unlock(&sim->lock);
+        return -1;
+    }
+    ep->closed = 1;
+    while (ep->queue != NULL) {
+        SimDatagram *next = ep->queue->next;
+        free(ep->queue);
+        ep->queue = next;
+    }
+    // The remaining endpoint may now be the only one holding the clock back
+    pthread_cond_broadcast(&sim->wake);
+    pthread_mutex_unlock(&sim->lock);
+    return 0;
+}
+
+static int sim_local_address(void *ctx, int socket, struct sockaddr *addr, socklen_t *len) {
+    RUDP_Sim *sim = (RUDP_Sim *)ctx;
+    pthread_mutex_lock(&sim->lock);
+    SimEndpoint *ep = sim_endpoint(sim, socket);
+    if (ep != NULL) {
+        sim_address(socket - SIM_FD_BASE, ep->bound, addr, len);
+    }
+    pthread_mutex_unlock(&sim->lock);
+    return ep != NULL ? 0 : -1;
+}
+
+static uint64_t sim_now_ms(void *ctx) {
+    RUDP_Sim *sim = (RUDP_Sim *)ctx;
+    pthread_mutex_lock(&sim->lock);
+    uint64_t now = sim->now;
+    pthread_mutex_unlock(&sim->lock);
+    return now;
+}
+
+RUDP_Sim *rudp_sim_create(const RUDP_SimConfig *config) {
+    RUDP_Sim *sim = calloc(1, sizeof(RUDP_Sim));
+    if (sim == NULL) {
+        perror("Failed to allocate memory for the simulator");
+        return NULL;
+    }
+    if (config != NULL) {
+        sim->config = *config;
+    }
+    for (int i = 0; i < SIM_ENDPOINTS; i++) {
+        // Mix the seed so nearby seeds give unrelated streams, xorshift needs a nonzero state
+        uint32_t x = sim->config.seed ^ (0x9E3779B9u * (i + 1));
+        x = (x ^ (x >> 16)) * 0x85EBCA6Bu;
+        x = (x ^ (x >> 13)) * 0xC2B2AE35u;
+        x ^= x >> 16;
+        sim->ends[i].rng = x != 0 ? x : 1;
+    }
+    pthread_mutex_init(&sim->lock, NULL);
+    pthread_cond_init(&sim->wake, NULL);
+
+    RUDP_Transport transport = {
+        sim_open, sim_bind, sim_connect, sim_send, sim_recv,
+        sim_set_timeout, sim_close, sim_local_address, sim_now_ms, sim
+    };
+    sim->transport = transport;
+    return sim;
+}
+
+const RUDP_Transport *rudp_sim_transport(RUDP_Sim *sim) {
+    return &sim->transport;
+}
+
+void rudp_sim_stats(RUDP_Sim *sim, RUDP_SimStats *stats) {
+    pthread_mutex_lock(&sim->lock);
+    *stats = sim->stats;
+    pthread_mutex_unlock(&sim->lock);
+}
+
+void rudp_sim_destroy(RUDP_Sim *sim) {
+    if (sim == NULL) {
+        return;
+    }
+    for (int i = 0; i < SIM_ENDPOINTS; i++) {
+        while (sim->ends[i].queue != NULL) {
+            SimDatagram *next = sim->ends[i].queue->next;
+            free(sim->ends[i].queue);
+            sim->ends[i].queue = next;
+        }
+    }
+    pthread_mutex_destroy(&sim->lock);
+    pthread_cond_destroy(&sim->wake);
+    free(sim);
+}
@@ -0,0 +1,1044 @@
+#include <errno.h>       // For error handling
+#include <fcntl.h>       // For opening /dev/null
+#include <pthread.h>     // For the receiver thread
+#include <stdio.h>       // For standard input/output operations
+#include <stdlib.h>      // For standard library functions
+#include <string.h>      // For string manipulation functions
+#include <unistd.h>      // For dup and dup2
+
+#include "RUDP_API.h"    // Header file for the Reliable UDP (RUDP) API
+
+#define SCENARIOS 5000           // Default number of randomized scenarios
+#define PARTIAL_SCENARIOS 1000   // Randomized scenarios with partial reliability
+#define COMPRESSED_SCENARIOS 1000 // Randomized scenarios with compressed text messages
+#define MAX_MESSAGES 4           // Messages sent per scenario
+#define MAX_MESSAGE_SIZE 20000   // Largest random message
+#define RTO_MS 1000              // Retransmission timeout of the library
+#define LATENCY_MS 5             // One-way latency of the throughput and recovery checks
+#define MIN_EFFICIENCY 0.9       // Lossless throughput, as a share of one packet per round trip
+#define STREAM_CHUNK 1000        // Bytes a stream producer hands out per call
+#define IDLE_LIMIT 12            // Receive timeouts (5 virtual seconds each) before the receiver gives up
+
+/**
+ * @struct Scenario
+ * @brief One randomized transfer over the simulated channel.
+ */
+typedef struct Scenario {
+    RUDP_SimConfig config;          /**< Link model. */
+    RUDP_Policy policy;             /**< Reliability policy of every message. */
+    int messages;                   /**< Number of messages sent. */
+    int sizes[MAX_MESSAGES];        /**< Size of each message. */
+    char *data[MAX_MESSAGES];       /**< Content of each message. */
+} Scenario;
+
+/**
+ * @struct Outcome
+ * @brief What the receiver saw and what the transfer cost in virtual time.
+ */
+typedef struct Outcome {
+    int connected;          /**< The handshake completed. */
+    int messages;           /**< Messages whose end was received. */
+    int whole;              /**< Messages received whole, without gaps. */
+    int errors;             /**< Wrong bytes, merged or split messages, unreported gaps. */
+    int closed;             /**< The receiver saw the sender close. */
+    int delivered;          /**< Messages the sender reported as fully delivered. */
+    uint64_t send_ms;       /**< Virtual time spent sending. */
+    uint64_t dropped;       /**< Datagrams lost while sending. */
+    uint64_t overrun_ms;    /**< Worst time a timed send ran past its expected bound. */
+    int negotiated;         /**< The receiver negotiated compression. */
+    uint64_t compressed;    /**< Data packets the sender compressed. */
+} Outcome;
+
+/**
+ * @struct Receiver
+ * @brief State of the receiver thread of a scenario.
+ */
+typedef struct Receiver {
+    int socket;                 /**< Receiver socket. */
+    const Scenario *scenario;   /**< Messages it should get. */
+    Outcome *outcome;           /**< Filled with what it got. */
+    RUDP_Sim *sim;              /**< Simulator, to close the socket when giving up. */
+} Receiver;
+
+/**
+ * @struct LossCounter
+ * @brief Transport wrapping the simulator that counts datagrams lost after a deadline.
+ */
+typedef struct LossCounter {
+    RUDP_Transport transport;     /**< Installed transport, delegates to the simulator. */
+    const RUDP_Transport *sim;    /**< Transport of the simulator. */
+    RUDP_Sim *handle;             /**< The simulator, for its loss counter. */
+    pthread_mutex_t lock;         /**< Keeps each loss with the send that caused it. */
+    uint64_t deadline;            /**< Losses from this virtual time on are counted. */
+    uint64_t late;                /**< Datagrams lost at or after the deadline. */
+} LossCounter;
+
+/**
+ * @struct Stream
+ * @brief One streamed message, produced by the sender and checked by the receiver.
+ */
+typedef struct Stream {
+    const char *data;       /**< Content of the message. */
+    int64_t size;           /**< Size of the message. */
+    int64_t offset;         /**< Bytes produced or consumed so far. */
+    int errors;             /**< Bytes that did not match the message. */
+    RUDP_Sim *sim;          /**< Simulator of a lossless transfer, to measure the read-ahead. */
+    uint64_t base;          /**< Datagrams the simulator had sent before the message. */
+    int64_t ahead;          /**< Most bytes produced ahead of the data packets sent. */
+} Stream;
+
+/**
+ * @struct StreamReceiver
+ * @brief State of the receiver thread of a stream check.
+ */
+typedef struct StreamReceiver {
+    int socket;             /**< Receiver socket. */
+    Stream stream;          /**< Message it should get, and what it got. */
+    int64_t total;          /**< Size reported by rudp_receive_stream. */
+    int complete;           /**< Completeness reported by rudp_receive_stream. */
+} StreamReceiver;
+
+static uint32_t test_rng;
+
+// xorshift32, so a seed always gives the same scenarios
+static uint32_t test_random() {
+    test_rng ^= test_rng << 13;
+    test_rng ^= test_rng >> 17;
+    test_rng ^= test_rng << 5;
+    return test_rng;
+}
+
+static double test_uniform() {
+    return (double)test_random() / 4294967296.0;
+}
+
+static int counter_open(void *ctx) {
+    const RUDP_Transport *sim = ((LossCounter *)ctx)->sim;
+    return sim->open(sim->ctx);
+}
+
+static int counter_bind(void *ctx, int socket, const struct sockaddr *addr, socklen_t len) {
+    const RUDP_Transport *sim = ((LossCounter *)ctx)->sim;
+    return sim->bind(sim->ctx, socket, addr, len);
+}
+
+static int counter_connect(void *ctx, int socket, const struct sockaddr *addr, socklen_t len) {
+    const RUDP_Transport *sim = ((LossCounter *)ctx)->sim;
+    return sim->connect(sim->ctx, socket, addr, len);
+}
+
+static ssize_t counter_send(void *ctx, int socket, const void *buf, size_t len) {
+    LossCounter *counter = (LossCounter *)ctx;
+    RUDP_SimStats before, after;
+    pthread_mutex_lock(&counter->lock);
+    rudp_sim_stats(counter->handle, &before);
+    ssize_t res = counter->sim->send(counter->sim->ctx, socket, buf, len);
+    rudp_sim_stats(counter->handle, &after);
+    if (after.dropped != before.dropped && counter->sim->now_ms(counter->sim->ctx) >= counter->deadline) {
+        counter->late++;
+    }
+    pthread_mutex_unlock(&counter->lock);
+    return res;
+}
+
+static ssize_t counter_recv(void *ctx, int socket, void *buf, size_t len,
+                            struct sockaddr *from, socklen_t *fromlen) {
+    const RUDP_Transport *sim = ((LossCounter *)ctx)->sim;
+    return sim->recv(sim->ctx, socket, buf, len, from, fromlen);
+}
+
+static int counter_set_timeout(void *ctx, int socket, const struct timeval *tv) {
+    const RUDP_Transport *sim = ((LossCounter *)ctx)->sim;
+    return sim->set_timeout(sim->ctx, socket, tv);
+}
+
+static int counter_close(void *ctx, int socket) {
+    const RUDP_Transport *sim = ((LossCounter *)ctx)->sim;
+    return sim->close(sim->ctx, socket);
+}
+
+static int counter_local_address(void *ctx, int socket, struct sockaddr *addr, socklen_t *len) {
+    const RUDP_Transport *sim = ((LossCounter *)ctx)->sim;
+    return sim->local_address(sim->ctx, socket, addr, len);
+}
+
+static uint64_t counter_now_ms(void *ctx) {
+    const RUDP_Transport *sim = ((LossCounter *)ctx)->sim;
+    return sim->now_ms(sim->ctx);
+}
+
+/**
+ * @brief Producer handing out a message in small chunks.
+ */
+int64_t stream_producer(void *arg, char *buf, size_t max) {
+    Stream *stream = (Stream *)arg;
+    int64_t chunk = stream->size - stream->offset;
+    if (chunk > STREAM_CHUNK) {
+        chunk = STREAM_CHUNK;
+    }
+    if (chunk > (int64_t)max) {
+        chunk = (int64_t)max;
+    }
+    memcpy(buf, stream->data + stream->offset, chunk);
+    stream->offset += chunk;
+    if (stream->sim != NULL) {
+        // Lossless and reliable: every data packet sent so far came with its ack
+        RUDP_SimStats stats;
+        rudp_sim_stats(stream->sim, &stats);
+        int64_t ahead = stream->offset - (int64_t)(stats.sent - stream->base) / 2 * MAX_PACK_SIZE;
+        if (ahead > stream->ahead) {
+            stream->ahead = ahead;
+        }
+    }
+    return chunk;
+}
+
+/**
+ * @brief Producer that claims more bytes than it was asked for.
+ */
+int64_t overrun_producer(void *arg, char *buf, size_t max) {
+    (void)arg;
+    (void)buf;
+    return (int64_t)max + 1;
+}
+
+/**
+ * @brief Consumer comparing the received bytes with the message.
+ */
+int stream_consumer(void *arg, const char *data, size_t len) {
+    Stream *stream = (Stream *)arg;
+    if (stream->offset + (int64_t)len > stream->size ||
+        memcmp(data, stream->data + stream->offset, len) != 0) {
+        stream->errors++;
+    }
+    stream->offset += len;
+    return 0;
+}
+
+/**
+ * @brief Receiver thread of a stream check: receives one streamed message.
+ * @param arg Pointer to the StreamReceiver.
+ */
+void *stream_receiver(void *arg) {
+    StreamReceiver *rx = (StreamReceiver *)arg;
+    rx->total = -1;
+    if (rudp_accept(rx->socket, 0) > 0) {
+        rx->total = rudp_receive_stream(rx->socket, stream_consumer, &rx->stream, &rx->complete);
+    }
+    // Wait for the close so the sender does not retry it
+    char *buffer;
+    int size;
+    while (rudp_receive(rx->socket, &buffer, &size) >= 0) {
+    }
+    return NULL;
+}
+
+/**
+ * @brief Receiver thread: checks every message against the scenario until the sender closes.
+ * @param arg Pointer to the Receiver state.
+ */
+void *receiver(void *arg) {
+    Receiver *rx = (Receiver *)arg;
+    const Scenario *scenario = rx->scenario;
+    Outcome *outcome = rx->outcome;
+    const RUDP_Transport *sim = rudp_sim_transport(rx->sim);
+    if (rudp_accept(rx->socket, 0) <= 0) {
+        // Leave the clock to the endpoints still in use
+        sim->close(sim->ctx, rx->socket);
+        return NULL;
+    }
+    outcome->negotiated = rudp_compression_negotiated(rx->socket);
+
+    int message = 0;
+    int offset = 0;
+    int gap = 0;
+    int idle = 0;
+    while (1) {
+        char *buffer = NULL;
+        int size = 0;
+        int res = rudp_receive(rx->socket, &buffer, &size);
+        if (res == -1 && errno == EAGAIN && ++idle < IDLE_LIMIT) {
+            continue;  // Long loss burst, the sender is still retransmitting
+        }
+        idle = 0;
+        if (res < 0) {
+            outcome->closed = (res == -5);
+            if (res == -1) {
+                sim->close(sim->ctx, rx->socket);
+            }
+            return NULL;
+        }
+        if (res == 2) {
+            // Skipped data is only expected when the sender may abandon it
+            gap = 1;
+            outcome->errors += scenario->policy.mode == RUDP_RELIABLE;
+            continue;
+        }
+        if (res != 1 && res != 5) {
+            continue;
+        }
+        if (size > 0) {
+            // After a gap the data resumes at the start of a later packet
+            int at = offset;
+            if (gap && at % MAX_PACK_SIZE != 0) {
+                at += MAX_PACK_SIZE - at % MAX_PACK_SIZE;
+            }
+            while (gap && message < scenario->messages && at + size <= scenario->sizes[message] &&
+                   memcmp(buffer, scenario->data[message] + at, size) != 0) {
+                at += MAX_PACK_SIZE;
+            }
+            if (message >= scenario->messages || at + size > scenario->sizes[message] ||
+                memcmp(buffer, scenario->data[message] + at, size) != 0) {
+                outcome->errors++;
+            } else {
+                offset = at + size;
+            }
+        }
+        free(buffer);
+        if (res == 5) {
+            if (message >= scenario->messages) {
+                outcome->errors++;  // More ends than messages
+            } else {
+                outcome->messages++;
+                outcome->whole += !gap && offset == scenario->sizes[message];
+            }
+            message++;
+            offset = 0;
+            gap = 0;
+        }
+    }
+}
+
+/**
+ * @brief Runs one scenario: connects, sends every message and closes.
+ * @param scenario Scenario to run.
+ * @param outcome Filled with the result.
+ * @return 0 if the scenario ran, or -1 if the simulator could not be set up.
+ */
+int run_scenario(const Scenario *scenario, Outcome *outcome) {
+    memset(outcome, 0, sizeof(*outcome));
+    RUDP_Sim *sim = rudp_sim_create(&scenario->config);
+    if (sim == NULL) {
+        return -1;
+    }
+    LossCounter counter = {
+        { counter_open, counter_bind, counter_connect, counter_send, counter_recv,
+          counter_set_timeout, counter_close, counter_local_address, counter_now_ms, &counter },
+        rudp_sim_transport(sim), sim, PTHREAD_MUTEX_INITIALIZER, UINT64_MAX, 0
+    };
+    rudp_set_transport(&counter.transport);
+
+    Receiver rx = { rudp_socket(), scenario, outcome, sim };
+    int sockfd = rudp_socket();
+    pthread_t thread;
+    if (rx.socket == -1 || sockfd == -1 || pthread_create(&thread, NULL, receiver, &rx) != 0) {
+        rudp_set_transport(NULL);
+        rudp_sim_destroy(sim);
+        return -1;
+    }
+
+    outcome->connected = rudp_connect(sockfd, "127.0.0.1", 1) == 1;
+    if (outcome->connected) {
+        // Longest round trip, when both datagrams are held back for reordering
+        uint64_t rtt = 2 * (3 * (uint64_t)scenario->config.latency_ms + 2);
+        RUDP_SimStats first, after;
+        rudp_sim_stats(sim, &first);
+        uint64_t start = rudp_now_ms();
+        for (int i = 0; i < scenario->messages; i++) {
+            uint64_t begin = rudp_now_ms();
+            pthread_mutex_lock(&counter.lock);
+            counter.deadline = begin + scenario->policy.ttl_ms;
+            counter.late = 0;
+            pthread_mutex_unlock(&counter.lock);
+            int res = rudp_send_ex(sockfd, scenario->data[i], scenario->sizes[i], &scenario->policy);
+            if (res < 0) {
+                outcome->errors++;
+            }
+            outcome->delivered += res == 1;
+            // A timed send stops at its time-to-live, then only waits for its end marker,
+            // which costs a retransmission timeout per datagram lost after the deadline
+            pthread_mutex_lock(&counter.lock);
+            uint64_t late = counter.late;
+            pthread_mutex_unlock(&counter.lock);
+            uint64_t took = rudp_now_ms() - begin;
+            uint64_t bound = scenario->policy.ttl_ms + rtt + late * RTO_MS;
+            if (scenario->policy.mode == RUDP_TIMED && took > bound && took - bound > outcome->overrun_ms) {
+                outcome->overrun_ms = took - bound;
+            }
+        }
+        outcome->send_ms = rudp_now_ms() - start;
+        rudp_sim_stats(sim, &after);
+        outcome->dropped = after.dropped - first.dropped;
+        RUDP_CompStats stats;
+        rudp_compression_stats(sockfd, &stats);
+        outcome->compressed = stats.packets_compressed;
+        rudp_close(sockfd);
+    } else {
+        // Gave up on the handshake, let the receiver fail instead of waiting forever
+        counter.transport.close(&counter, sockfd);
+    }
+    pthread_join(thread, NULL);
+
+    rudp_set_transport(NULL);
+    pthread_mutex_destroy(&counter.lock);
+    rudp_sim_destroy(sim);
+    return 0;
+}
+
+/**
+ * @brief Fills a buffer with log-like text lines, which compress well but never repeat exactly.
+ * @param data Buffer to fill.
+ * @param size Number of bytes to write.
+ */
+void fill_text(char *data, int size) {
+    static const char *levels[] = { "INFO", "WARN", "DEBUG", "ERROR" };
+    static const char *events[] = { "packet sent", "ack received", "timeout expired", "connection closed" };
+    char line[128];
+    int offset = 0;
+    while (offset < size) {
+        int len = snprintf(line, sizeof(line), "%08u [%s] peer %u.%u: %s, seq %u\n",
+                           test_random() % 100000000, levels[test_random() % 4], test_random() % 256,
+                           test_random() % 256, events[test_random() % 4], test_random() % 65536);
+        if (len > size - offset) {
+            len = size - offset;
+        }
+        memcpy(data + offset, line, len);
+        offset += len;
+    }
+}
+
+/**
+ * @brief Fills a scenario with a random link model and random messages.
+ * @param scenario Scenario to fill, its data buffers must hold MAX_MESSAGE_SIZE bytes.
+ * @param text Nonzero for compressible text messages, 0 for random bytes.
+ */
+void random_scenario(Scenario *scenario, int text) {
+    scenario->config.loss = test_uniform() * 0.2;
+    scenario->config.reorder = test_uniform() * 0.3;
+    scenario->config.latency_ms = 1 + test_random() % 20;
+    scenario->config.seed = test_random();
+    scenario->policy.mode = RUDP_RELIABLE;
+    scenario->messages = 1 + test_random() % MAX_MESSAGES;
+    for (int i = 0; i < scenario->messages; i++) {
+        // Exact multiples of the packet size end on a full packet
+        if (test_random() % 4 == 0) {
+            scenario->sizes[i] = MAX_PACK_SIZE * (1 + test_random() % (MAX_MESSAGE_SIZE / MAX_PACK_SIZE));
+        } else {
+            scenario->sizes[i] = 1 + test_random() % MAX_MESSAGE_SIZE;
+        }
+        if (text) {
+            fill_text(scenario->data[i], scenario->sizes[i]);
+            continue;
+        }
+        for (int j = 0; j < scenario->sizes[i]; j++) {
+            scenario->data[i][j] = (char)test_random();
+        }
+    }
+}
+
+/**
+ * @brief Checks the payload codec: round trips of text and random data, output cut at a
+ *        small capacity, rejection of short output buffers and truncated blocks, and the
+ *        entropy check.
+ * @param out Stream for the report.
+ * @return Number of failed checks.
+ */
+int test_codec(FILE *out) {
+    static const int sizes[] = { 0, 1, 15, 16, 100, 4000, 20000, 65535 };
+    static const int capacities[] = { 1, 2, 16, 100, MAX_PACK_SIZE };
+    const int limit = 65535;
+    int failures = 0, checks = 0;
+    char *src = malloc(limit);
+    char *packed = malloc(limit + limit / 255 + 16);
+    char *unpacked = malloc(limit);
+    if (src == NULL || packed == NULL || unpacked == NULL) {
+        fprintf(out, "codec: failed to allocate memory\n");
+        free(src);
+        free(packed);
+        free(unpacked);
+        return 1;
+    }
+
+    for (int text = 0; text < 2; text++) {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            int size = sizes[i];
+            if (text) {
+                fill_text(src, size);
+            } else {
+                for (int j = 0; j < size; j++) {
+                    src[j] = (char)test_random();
+                }
+            }
+            // Worst case of the block format: one length byte per 255 literals
+            int consumed = -1;
+            int n = rudp_compress(src, size, packed, size + size / 255 + 16, &consumed);
+            int m = n < 0 ? -1 : rudp_decompress(packed, n, unpacked, size);
+            checks++;
+            if (consumed != size || m != size || memcmp(src, unpacked, size) != 0) {
+                fprintf(out, "codec: %s round trip of %d bytes gave %d/%d bytes\n",
+                        text ? "text" : "random", size, m, consumed);
+                failures++;
+            }
+        }
+    }
+
+    // Output full: the codec stops at a prefix that must round trip on its own
+    for (int text = 0; text < 2; text++) {
+        if (text) {
+            fill_text(src, limit);
+        } else {
+            for (int j = 0; j < limit; j++) {
+                src[j] = (char)test_random();
+            }
+        }
+        for (size_t i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++) {
+            int consumed = -1;
+            int n = rudp_compress(src, limit, packed, capacities[i], &consumed);
+            int m = n < 0 ? -1 : rudp_decompress(packed, n, unpacked, limit);
+            checks++;
+            if (n < 0 || n > capacities[i] || consumed < 0 || consumed >= limit || m != consumed ||
+                memcmp(src, unpacked, consumed) != 0) {
+                fprintf(out, "codec: %s input cut at capacity %d gave %d bytes for a %d byte prefix, %d back\n",
+                        text ? "text" : "random", capacities[i], n, consumed, m);
+                failures++;
+            }
+        }
+        if (text) {
+            checks++;
+            if (!rudp_compressible(src, limit)) {
+                fprintf(out, "codec: text not seen as compressible\n");
+                failures++;
+            }
+            // A capacity one byte short of the content must be refused, not overrun
+            int consumed = 0;
+            int n = rudp_compress(src, limit, packed, MAX_PACK_SIZE, &consumed);
+            checks++;
+            if (n > 0 && rudp_decompress(packed, n, unpacked, consumed - 1) != -1) {
+                fprintf(out, "codec: decompressed %d bytes into %d\n", consumed, consumed - 1);
+                failures++;
+            }
+        } else {
+            checks++;
+            if (rudp_compressible(src, limit)) {
+                fprintf(out, "codec: random data seen as compressible\n");
+                failures++;
+            }
+            // Random data is a single literal run, cutting its last byte must be caught
+            int consumed = 0;
+            int n = rudp_compress(src, 100, packed, 200, &consumed);
+            checks++;
+            if (n <= 0 || rudp_decompress(packed, n - 1, unpacked, limit) != -1) {
+                fprintf(out, "codec: truncated block of %d bytes was accepted\n", n);
+                failures++;
+            }
+        }
+    }
+
+    int consumed = 0;
+    checks++;
+    if (rudp_compress(src, limit, packed, 0, &consumed) != -1) {
+        fprintf(out, "codec: compressed into an empty buffer\n");
+        failures++;
+    }
+
+    free(src);
+    free(packed);
+    free(unpacked);
+    fprintf(out, "%s codec: %d checks, %d failed\n", failures == 0 ? "PASS" : "FAIL", checks, failures);
+    return failures;
+}
+
+/**
+ * @brief Sweeps randomized loss and reorder scenarios and checks delivery and boundaries.
+ *        With compression, both sides enable it, the messages are text, every connection
+ *        must negotiate it and the sender must compress some packets.
+ * @param out Stream for the report.
+ * @param scenarios Number of scenarios.
+ * @param data Message buffers of MAX_MESSAGE_SIZE bytes.
+ * @param compress Nonzero to sweep compressed connections.
+ * @return Number of failed scenarios.
+ */
+int test_sweep(FILE *out, int scenarios, char **data, int compress) {
+    int failures = 0, handshakes_lost = 0;
+    uint64_t compressed = 0;
+    Scenario scenario;
+    memcpy(scenario.data, data, sizeof(scenario.data));
+    rudp_set_compression(compress);
+    for (int i = 0; i < scenarios; i++) {
+        Outcome outcome;
+        random_scenario(&scenario, compress);
+        if (run_scenario(&scenario, &outcome) == -1) {
+            fprintf(out, "scenario %d: failed to set up the simulator\n", i);
+            return failures + 1;
+        }
+        if (!outcome.connected) {
+            handshakes_lost++;  // rudp_connect gives up after 3 lost attempts
+            continue;
+        }
+        compressed += outcome.compressed;
+        if (outcome.errors != 0 || outcome.whole != scenario.messages || !outcome.closed ||
+            outcome.negotiated != compress) {
+            fprintf(out, "scenario %d (loss %.3f reorder %.3f latency %u seed %u): %d/%d messages, %d errors%s%s\n",
+                    i, scenario.config.loss, scenario.config.reorder, scenario.config.latency_ms,
+                    scenario.config.seed, outcome.whole, scenario.messages, outcome.errors,
+                    outcome.closed ? "" : ", close not seen",
+                    outcome.negotiated == compress ? "" : ", wrong compression negotiated");
+            failures++;
+        }
+    }
+    rudp_set_compression(0);
+    if (compress && scenarios > 0 && compressed == 0) {
+        fprintf(out, "compressed sweep: no packet was sent compressed\n");
+        failures++;
+    }
+    if (compress) {
+        fprintf(out, "%s compressed sweep: %d scenarios, %d failed, %d handshakes given up, %llu packets compressed\n",
+                failures == 0 ? "PASS" : "FAIL", scenarios, failures, handshakes_lost,
+                (unsigned long long)compressed);
+    } else {
+        fprintf(out, "%s sweep: %d scenarios, %d failed, %d handshakes given up\n",
+                failures == 0 ? "PASS" : "FAIL", scenarios, failures, handshakes_lost);
+    }
+    return failures;
+}
+
+/**
+ * @brief Checks that a lossless channel carries close to one full packet per round trip.
+ * @param out Stream for the report.
+ * @param data Message buffers of MAX_MESSAGE_SIZE bytes.
+ * @return 0 on success, 1 on failure.
+ */
+int test_throughput(FILE *out, char **data) {
+    Scenario scenario = { { 0, 0, LATENCY_MS, 1 }, { RUDP_RELIABLE, 0, 0 }, MAX_MESSAGES, { 0 }, { NULL } };
+    for (int i = 0; i < MAX_MESSAGES; i++) {
+        scenario.sizes[i] = MAX_MESSAGE_SIZE;
+        scenario.data[i] = data[i];
+    }
+    Outcome outcome;
+    if (run_scenario(&scenario, &outcome) == -1 || outcome.whole != MAX_MESSAGES || outcome.send_ms == 0) {
+        fprintf(out, "FAIL throughput: transfer failed\n");
+        return 1;
+    }
+    double bound = (double)MAX_PACK_SIZE / (2 * scenario.config.latency_ms);
+    double speed = (double)MAX_MESSAGES * MAX_MESSAGE_SIZE / outcome.send_ms;
+    int ok = speed >= MIN_EFFICIENCY * bound;
+    fprintf(out, "%s throughput: %.0f bytes per virtual ms, stop-and-wait bound %.0f\n",
+            ok ? "PASS" : "FAIL", speed, bound);
+    return !ok;
+}
+
+/**
+ * @brief Checks that every lost datagram costs at most one retransmission timeout
+ *        plus a round trip.
+ * @param out Stream for the report.
+ * @param data Message buffers of MAX_MESSAGE_SIZE bytes.
+ * @return 0 on success, 1 on failure.
+ */
+int test_recovery(FILE *out, char **data) {
+    int failures = 0;
+    uint64_t worst = 0;
+    uint64_t rtt = 2 * LATENCY_MS;
+    for (uint32_t seed = 1; seed <= 50; seed++) {
+        Scenario scenario = { { 0.1, 0, LATENCY_MS, seed }, { RUDP_RELIABLE, 0, 0 }, MAX_MESSAGES, { 0 }, { NULL } };
+        int packets = 0;
+        for (int i = 0; i < MAX_MESSAGES; i++) {
+            scenario.sizes[i] = MAX_MESSAGE_SIZE;
+            scenario.data[i] = data[i];
+            packets += (MAX_MESSAGE_SIZE + MAX_PACK_SIZE - 1) / MAX_PACK_SIZE;
+        }
+        Outcome outcome;
+        if (run_scenario(&scenario, &outcome) == -1 || !outcome.connected) {
+            continue;
+        }
+        uint64_t bound = packets * rtt + outcome.dropped * (RTO_MS + rtt);
+        if (outcome.whole != MAX_MESSAGES || outcome.send_ms > bound) {
+            fprintf(out, "recovery seed %u: %d messages in %llu virtual ms, bound %llu\n", seed,
+                    outcome.whole, (unsigned long long)outcome.send_ms, (unsigned long long)bound);
+            failures++;
+        }
+        if (outcome.dropped > 0 && (outcome.send_ms - packets * rtt) / outcome.dropped > worst) {
+            worst = (outcome.send_ms - packets * rtt) / outcome.dropped;
+        }
+    }
+    fprintf(out, "%s recovery: worst %llu virtual ms per lost datagram, bound %llu\n",
+            failures == 0 ? "PASS" : "FAIL", (unsigned long long)worst,
+            (unsigned long long)(RTO_MS + rtt));
+    return failures != 0;
+}
+
+/**
+ * @brief Drives two connections from one thread and interleaves their messages. Each
+ *        connection must keep its own sequence and message numbers.
+ * @param out Stream for the report.
+ * @param data Message buffers of MAX_MESSAGE_SIZE bytes.
+ * @return Number of failed runs.
+ */
+int test_connections(FILE *out, char **data) {
+    // Message of each connection sent at each step: both connect first, then a0 b0 b1 a1
+    static const int order[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+    int failures = 0;
+    int runs = 0;
+    for (uint32_t seed = 1; seed <= 20; seed++) {
+        RUDP_SimConfig config = { seed == 1 ? 0 : 0.1, seed == 1 ? 0 : 0.1, LATENCY_MS, seed };
+        RUDP_Sim *sim = rudp_sim_create(&config);
+        if (sim == NULL) {
+            return failures + 1;
+        }
+        rudp_set_transport(rudp_sim_transport(sim));
+
+        // Sockets are paired in the order they are opened: receiver, then sender
+        Scenario scenarios[2];
+        Outcome outcomes[2];
+        Receiver rx[2];
+        int sockets[2];
+        pthread_t threads[2];
+        int started = 0;
+        memset(scenarios, 0, sizeof(scenarios));
+        memset(outcomes, 0, sizeof(outcomes));
+        for (int c = 0; c < 2; c++) {
+            scenarios[c].policy.mode = RUDP_RELIABLE;
+            scenarios[c].messages = 2;
+            for (int m = 0; m < 2; m++) {
+                scenarios[c].sizes[m] = MAX_MESSAGE_SIZE - 1000 * (2 * c + m) - c;
+                scenarios[c].data[m] = data[2 * c + m];
+            }
+            rx[c] = (Receiver){ rudp_socket(), &scenarios[c], &outcomes[c], sim };
+            sockets[c] = rudp_socket();
+        }
+        for (; started < 2; started++) {
+            if (rx[started].socket == -1 || sockets[started] == -1 ||
+                pthread_create(&threads[started], NULL, receiver, &rx[started]) != 0) {
+                break;
+            }
+        }
+
+        int connected = started == 2;
+        for (int c = 0; c < 2 && connected; c++) {
+            connected = rudp_connect(sockets[c], "127.0.0.1", 1) == 1;
+        }
+        int sent = 0;
+        for (int i = 0; i < 4 && connected; i++) {
+            const Scenario *scenario = &scenarios[order[i][0]];
+            int m = order[i][1];
+            sent += rudp_send(sockets[order[i][0]], scenario->data[m], scenario->sizes[m]) == 1;
+        }
+        for (int c = 0; c < 2; c++) {
+            if (connected) {
+                rudp_close(sockets[c]);
+            } else if (sockets[c] != -1) {
+                // Gave up on a handshake, let the receivers fail instead of waiting forever
+                rudp_sim_transport(sim)->close(rudp_sim_transport(sim)->ctx, sockets[c]);
+            }
+        }
+        for (int c = 0; c < started; c++) {
+            pthread_join(threads[c], NULL);
+        }
+        rudp_set_transport(NULL);
+        rudp_sim_destroy(sim);
+
+        if (started < 2) {
+            fprintf(out, "connections seed %u: failed to set up the simulator\n", seed);
+            return failures + 1;
+        }
+        if (!connected) {
+            continue;
+        }
+        runs++;
+        for (int c = 0; c < 2; c++) {
+            if (sent != 4 || outcomes[c].whole != 2 || outcomes[c].messages != 2 || outcomes[c].errors != 0) {
+                fprintf(out, "connections seed %u, connection %d: %d/4 sends delivered, %d/2 whole, %d ends, %d errors\n",
+                        seed, c, sent, outcomes[c].whole, outcomes[c].messages, outcomes[c].errors);
+                failures++;
+                break;
+            }
+        }
+    }
+    fprintf(out, "%s two connections on one thread: %d runs, %d failed\n",
+            failures == 0 ? "PASS" : "FAIL", runs, failures);
+    return failures;
+}
+
+/**
+ * @brief Sweeps randomized scenarios with partial reliability policies. Every message
+ *        must end exactly once, skipped data must be reported, messages the sender
+ *        reports as delivered must arrive whole, and a timed send must return once its
+ *        time-to-live has passed and its end marker got through.
+ * @param out Stream for the report.
+ * @param scenarios Number of scenarios.
+ * @param data Message buffers of MAX_MESSAGE_SIZE bytes.
+ * @return Number of failed scenarios.
+ */
+int test_partial(FILE *out, int scenarios, char **data) {
+    int failures = 0;
+    uint64_t worst = 0;
+    Scenario scenario;
+    memcpy(scenario.data, data, sizeof(scenario.data));
+    for (int i = 0; i < scenarios; i++) {
+        Outcome outcome;
+        random_scenario(&scenario, 0);
+        scenario.config.loss = test_uniform() * 0.3;
+        if (test_random() % 2 == 0) {
+            scenario.policy.mode = RUDP_LIMITED_RETX;
+            scenario.policy.max_retx = test_random() % 3;
+        } else {
+            scenario.policy.mode = RUDP_TIMED;
+            scenario.policy.ttl_ms = test_random() % 4 == 0 ? 0 : test_random() % 200;
+        }
+        if (run_scenario(&scenario, &outcome) == -1) {
+            fprintf(out, "partial scenario %d: failed to set up the simulator\n", i);
+            return failures + 1;
+        }
+        if (!outcome.connected) {
+            continue;
+        }
+        if (outcome.overrun_ms > worst) {
+            worst = outcome.overrun_ms;
+        }
+        if (outcome.errors != 0 || outcome.messages != scenario.messages || !outcome.closed ||
+            outcome.whole < outcome.delivered || outcome.overrun_ms > 0) {
+            fprintf(out, "partial scenario %d (%s %d, loss %.3f reorder %.3f latency %u seed %u): "
+                    "%d/%d ends, %d whole, %d delivered, %d errors, %llu ms late%s\n",
+                    i, scenario.policy.mode == RUDP_TIMED ? "ttl_ms" : "max_retx",
+                    scenario.policy.mode == RUDP_TIMED ? (int)scenario.policy.ttl_ms : scenario.policy.max_retx,
+                    scenario.config.loss, scenario.config.reorder,
+                    scenario.config.latency_ms, scenario.config.seed, outcome.messages, scenario.messages,
+                    outcome.whole, outcome.delivered, outcome.errors, (unsigned long long)outcome.overrun_ms,
+                    outcome.closed ? "" : ", close not seen");
+            failures++;
+        }
+    }
+    fprintf(out, "%s partial reliability: %d scenarios, %d failed, worst timed send %llu ms past its bound\n",
+            failures == 0 ? "PASS" : "FAIL", scenarios, failures, (unsigned long long)worst);
+    return failures;
+}
+
+/**
+ * @brief Streams one message over the simulated channel.
+ * @param config Link model.
+ * @param policy Reliability policy of the message.
+ * @param producer Producer of the message, or NULL to send it with rudp_send_iov cut
+ *        into uneven buffers.
+ * @param data Content of the message.
+ * @param size Size of the message.
+ * @param rx Filled with what the receiver got.
+ * @param datagrams Set to the number of datagrams the transfer took, acks included.
+ * @param ahead Set to the most bytes produced ahead of the data packets sent, or NULL
+ *        if the link is lossy.
+ * @return 0 if the whole message was sent, or -1 if the stream could not be set up,
+ *         connect or send.
+ */
+int run_stream(const RUDP_SimConfig *config, const RUDP_Policy *policy, rudp_producer_fn producer,
+               const char *data, int64_t size, StreamReceiver *rx, uint64_t *datagrams, int64_t *ahead) {
+    RUDP_Sim *sim = rudp_sim_create(config);
+    if (sim == NULL) {
+        return -1;
+    }
+    rudp_set_transport(rudp_sim_transport(sim));
+    memset(rx, 0, sizeof(*rx));
+    rx->socket = rudp_socket();
+    rx->stream.data = data;
+    rx->stream.size = size;
+    Stream source = { data, size, 0, 0, NULL, 0, 0 };
+    int sockfd = rudp_socket();
+    pthread_t thread;
+    if (rx->socket == -1 || sockfd == -1 || pthread_create(&thread, NULL, stream_receiver, rx) != 0) {
+        rudp_set_transport(NULL);
+        rudp_sim_destroy(sim);
+        return -1;
+    }
+
+    int res = -1;
+    if (rudp_connect(sockfd, "127.0.0.1", 1) == 1) {
+        RUDP_SimStats before, after;
+        rudp_sim_stats(sim, &before);
+        source.sim = ahead != NULL ? sim : NULL;
+        source.base = before.sent;
+        int64_t sent;
+        if (producer != NULL) {
+            sent = rudp_send_stream(sockfd, producer, &source, policy);
+        } else {
+            // Empty, tiny, packet-sized and large buffers, so packets straddle them
+            int64_t cuts[] = { 0, 0, size / 7, size / 7 + 1, size / 7 + 1 + MAX_PACK_SIZE, size };
+            struct iovec iov[5];
+            for (int i = 0; i < 5; i++) {
+                int64_t from = cuts[i] < size ? cuts[i] : size;
+                int64_t to = cuts[i + 1] < size ? cuts[i + 1] : size;
+                iov[i].iov_base = (void *)(data + from);
+                iov[i].iov_len = (size_t)(to - from);
+            }
+            sent = rudp_send_iov(sockfd, iov, 5, policy);
+        }
+        if (sent == size) {
+            res = 0;
+        }
+        rudp_sim_stats(sim, &after);
+        *datagrams = after.sent - before.sent;
+        if (ahead != NULL) {
+            *ahead = source.ahead;
+        }
+        rudp_close(sockfd);
+    } else {
+        rudp_sim_transport(sim)->close(rudp_sim_transport(sim)->ctx, sockfd);
+    }
+    pthread_join(thread, NULL);
+
+    rudp_set_transport(NULL);
+    rudp_sim_destroy(sim);
+    return res;
+}
+
+/**
+ * @brief Checks streamed messages: every packet but the last is full, so a stream that
+ *        fills its last packet exactly takes no extra empty packet, the sender reads at
+ *        most a packet ahead, rudp_send_iov sends buffers as one message, an overrunning
+ *        producer fails the send, and a receiver is told when the sender abandoned part
+ *        of the stream.
+ * @param out Stream for the report.
+ * @param data Message buffers of MAX_MESSAGE_SIZE bytes.
+ * @return Number of failed checks.
+ */
+int test_stream(FILE *out, char **data) {
+    int failures = 0;
+    RUDP_Policy reliable = { RUDP_RELIABLE, 0, 0 };
+    RUDP_SimConfig lossless = { 0, 0, LATENCY_MS, 1 };
+    // Streams that end exactly where the staging buffer fills up cover the end-of-stream peek
+    const int64_t sizes[] = { 0, 1, MAX_PACK_SIZE, 3 * MAX_PACK_SIZE + 1, MAX_RAW_SIZE,
+                              MAX_RAW_SIZE + MAX_PACK_SIZE, 2 * MAX_RAW_SIZE };
+    char *large = malloc(2 * MAX_RAW_SIZE);
+    if (large == NULL) {
+        fprintf(out, "Failed to allocate memory for the streams\n");
+        return 1;
+    }
+    for (int i = 0; i < 2 * MAX_RAW_SIZE; i++) {
+        large[i] = (char)test_random();
+    }
+    for (size_t i = 0; i < 2 * sizeof(sizes) / sizeof(sizes[0]); i++) {
+        int iov = i % 2;
+        int64_t size = sizes[i / 2];
+        StreamReceiver rx;
+        uint64_t datagrams = 0;
+        int64_t ahead = 0;
+        int64_t packets = size == 0 ? 1 : (size + MAX_PACK_SIZE - 1) / MAX_PACK_SIZE;
+        if (run_stream(&lossless, &reliable, iov ? NULL : stream_producer, large, size, &rx,
+                       &datagrams, &ahead) == -1 ||
+            rx.total != size || !rx.complete || rx.stream.errors != 0 ||
+            datagrams != (uint64_t)(2 * packets)) {
+            fprintf(out, "%s of %lld bytes: received %lld (complete %d, %d errors) in %llu datagrams, expected %lld\n",
+                    iov ? "iovec" : "stream", (long long)size, (long long)rx.total, rx.complete,
+                    rx.stream.errors, (unsigned long long)datagrams, (long long)(2 * packets));
+            failures++;
+        }
+        // The staging buffer fills one packet, then the end-of-stream peek takes one more chunk
+        if (!iov && ahead > MAX_PACK_SIZE + STREAM_CHUNK) {
+            fprintf(out, "stream of %lld bytes: produced %lld bytes ahead of the packets sent\n",
+                    (long long)size, (long long)ahead);
+            failures++;
+        }
+    }
+    free(large);
+
+    StreamReceiver overrun;
+    uint64_t datagrams = 0;
+    if (run_stream(&lossless, &reliable, overrun_producer, data[0], MAX_MESSAGE_SIZE, &overrun,
+                   &datagrams, NULL) != -1) {
+        fprintf(out, "stream from an overrunning producer was sent\n");
+        failures++;
+    }
+
+    // Abandoned segments must be reported, and a stream reported whole must be intact
+    RUDP_Policy limited = { RUDP_LIMITED_RETX, 0, 0 };
+    int gaps = 0;
+    for (uint32_t seed = 1; seed <= 50; seed++) {
+        RUDP_SimConfig lossy = { 0.2, 0, LATENCY_MS, seed };
+        StreamReceiver rx;
+        uint64_t datagrams = 0;
+        if (run_stream(&lossy, &limited, stream_producer, data[0], MAX_MESSAGE_SIZE, &rx, &datagrams, NULL) == -1 ||
+            rx.total < 0) {
+            continue;  // Lost the handshake
+        }
+        gaps += !rx.complete;
+        if (rx.complete ? rx.total != MAX_MESSAGE_SIZE || rx.stream.errors != 0 : rx.total >= MAX_MESSAGE_SIZE) {
+            fprintf(out, "lossy stream seed %u: received %lld bytes, complete %d, %d errors\n",
+                    seed, (long long)rx.total, rx.complete, rx.stream.errors);
+            failures++;
+        }
+    }
+    fprintf(out, "%s streaming: exact packet counts over producers and iovecs, %d gaps reported\n",
+            failures == 0 ? "PASS" : "FAIL", gaps);
+    return failures;
+}
+
+/**
+ * @brief Main function of the protocol tests over the simulated transport.
+ *
+ * Usage: RUDP_Test [-n scenarios] [-s seed] [-v]
+ * The library's connection messages are discarded unless -v is given.
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line argument strings.
+ * @return 0 if every check passed, 1 otherwise.
+ */
+int main(int argc, char *argv[]) {
+    int scenarios = SCENARIOS;
+    uint32_t seed = 1;
+    int verbose = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            scenarios = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else {
+            printf("Usage: %s [-n scenarios] [-s seed] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    test_rng = seed != 0 ? seed : 1;
+
+    // Report on the original stderr, silence the library unless asked not to
+    FILE *out = fdopen(dup(STDERR_FILENO), "w");
+    if (out == NULL) {
+        perror("Failed to open the report stream");
+        return 1;
+    }
+    setvbuf(out, NULL, _IOLBF, 0);
+    if (!verbose) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull != -1) {
+            fflush(stdout);
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+    }
+
+    char *data[MAX_MESSAGES];
+    for (int i = 0; i < MAX_MESSAGES; i++) {
+        data[i] = malloc(MAX_MESSAGE_SIZE);
+        if (data[i] == NULL) {
+            fprintf(out, "Failed to allocate memory for the messages\n");
+            return 1;
+        }
+        for (int j = 0; j < MAX_MESSAGE_SIZE; j++) {
+            data[i][j] = (char)test_random();
+        }
+    }
+
+    fprintf(out, "Seed %u\n", seed);
+    int failed = 0;
+    failed += test_throughput(out, data) != 0;
+    failed += test_recovery(out, data) != 0;
+    failed += test_connections(out, data) != 0;
+    failed += test_codec(out) != 0;
+    failed += test_sweep(out, scenarios, data, 0) != 0;
+    failed += test_sweep(out, scenarios * COMPRESSED_SCENARIOS / SCENARIOS, data, 1) != 0;
+    failed += test_partial(out, scenarios * PARTIAL_SCENARIOS / SCENARIOS, data) != 0;
+    failed += test_stream(out, data) != 0;
+
+    for (int i = 0; i < MAX_MESSAGES; i++) {
+        free(data[i]);
+    }
+    fprintf(out, "%s\n", failed == 0 ? "All tests passed" : "Some tests failed");
+    fclose(out);
+    return failed == 0 ? 0 : 1;
+}